@@ -0,0 +1,456 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include "snes.h"
+#include "movie.h"
+
+// headless batch runner: runs jobs (rom, frame count, outputs) on a pool of threads, each job with its own instance
+// usage: lakesnes_batch [-j threads] [-o report] jobfile
+// each line in the jobfile is a job: <rom path> <frames> [movie=<movie path>] [frame=<ppm path>] [audio=<raw path>]
+// [hashes=<path>] [expect=<path>]
+// with a movie, frames can be 0 to run for the length of the movie
+// hashes writes the hash of every frame's video output, dsp samples and state, expect compares against such a file
+// (golden hashes, or hashes from a reference build to run against in lockstep)
+// empty lines and lines starting with # are ignored, paths can't contain spaces
+// the report has a line per job, in jobfile order: index, rom, frames, result, frame hash, audio hash, state hash, time
+// the result is ok, failed, or mismatch at the first frame that differs from the expected hashes
+// each rom is loaded once (mapped from the file) and shared by all jobs using it
+
+typedef struct BatchJob {
+  // description
+  char* romPath;
+  int frames;
+  char* moviePath; // movie to play back, can be NULL
+  char* framePath; // final frame as ppm, can be NULL
+  char* audioPath; // all samples as raw signed 16-bit stereo, can be NULL
+  char* hashPath; // per-frame hashes output, can be NULL
+  char* expectPath; // expected per-frame hashes, can be NULL
+  RomImage* rom; // NULL if it failed to load
+  bool ownsRom; // if the first job with this rom, which releases it
+  // results
+  bool failed;
+  const char* error;
+  int mismatchFrame; // first frame with hashes different from the expected ones, -1 if none
+  bool videoMismatch;
+  bool audioMismatch;
+  bool stateMismatch;
+  uint64_t frameHash;
+  uint64_t audioHash;
+  uint64_t stateHash;
+  double time;
+} BatchJob;
+
+typedef struct JobQueue {
+  // deque of job indices, the owning worker takes from the back, others steal from the front
+  pthread_mutex_t lock;
+  int* jobs;
+  int front;
+  int back;
+} JobQueue;
+
+typedef struct Worker {
+  pthread_t thread;
+  int index;
+  struct BatchRunner* runner;
+} Worker;
+
+typedef struct BatchRunner {
+  BatchJob* jobs;
+  int jobCount;
+  JobQueue* queues;
+  Worker* workers;
+  int workerCount;
+} BatchRunner;
+
+static bool readJobs(BatchRunner* runner, const char* path);
+static void loadRoms(BatchRunner* runner);
+static void* runWorker(void* data);
+static bool takeJob(BatchRunner* runner, int worker, int* job);
+static void runJob(BatchJob* job);
+static uint8_t* readFile(const char* name, int* length);
+static uint64_t* readHashes(const char* path, int* frames);
+static bool writePpm(const char* path, const uint8_t* pixels, int width, int height, int pitch);
+static uint64_t hashData(uint64_t hash, const uint8_t* data, int length);
+static double getTime(void);
+
+int main(int argc, char** argv) {
+  int threads = 4;
+  const char* reportPath = NULL;
+  const char* jobPath = NULL;
+  for(int i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      reportPath = argv[++i];
+    } else {
+      jobPath = argv[i];
+    }
+  }
+  if(jobPath == NULL || threads < 1) {
+    printf("Usage: %s [-j threads] [-o report] jobfile\n", argv[0]);
+    return 1;
+  }
+  BatchRunner runner = {};
+  if(!readJobs(&runner, jobPath)) {
+    printf("Failed to read jobfile '%s'\n", jobPath);
+    return 1;
+  }
+  loadRoms(&runner);
+  if(threads > runner.jobCount) threads = runner.jobCount > 0 ? runner.jobCount : 1;
+  // spread the jobs over the queues, then start the workers
+  runner.workerCount = threads;
+  runner.queues = malloc(threads * sizeof(JobQueue));
+  runner.workers = malloc(threads * sizeof(Worker));
+  for(int i = 0; i < threads; i++) {
+    pthread_mutex_init(&runner.queues[i].lock, NULL);
+    runner.queues[i].jobs = malloc((runner.jobCount / threads + 1) * sizeof(int));
+    runner.queues[i].front = 0;
+    runner.queues[i].back = 0;
+  }
+  for(int i = 0; i < runner.jobCount; i++) {
+    JobQueue* queue = &runner.queues[i % threads];
+    queue->jobs[queue->back++] = i;
+  }
+  double startTime = getTime();
+  for(int i = 0; i < threads; i++) {
+    runner.workers[i].index = i;
+    runner.workers[i].runner = &runner;
+    pthread_create(&runner.workers[i].thread, NULL, runWorker, &runner.workers[i]);
+  }
+  for(int i = 0; i < threads; i++) {
+    pthread_join(runner.workers[i].thread, NULL);
+  }
+  double totalTime = getTime() - startTime;
+  // write the report
+  FILE* report = reportPath != NULL ? fopen(reportPath, "w") : stdout;
+  if(report == NULL) {
+    printf("Failed to open report '%s'\n", reportPath);
+    return 1;
+  }
+  int failed = 0;
+  int mismatched = 0;
+  for(int i = 0; i < runner.jobCount; i++) {
+    BatchJob* job = &runner.jobs[i];
+    if(job->failed) {
+      failed++;
+      fprintf(report, "%d %s %d failed (%s)\n", i, job->romPath, job->frames, job->error);
+    } else if(job->mismatchFrame >= 0) {
+      mismatched++;
+      char kinds[32] = "";
+      if(job->videoMismatch) strcat(kinds, " video");
+      if(job->audioMismatch) strcat(kinds, " audio");
+      if(job->stateMismatch) strcat(kinds, " state");
+      fprintf(report, "%d %s %d mismatch at frame %d (%s)\n", i, job->romPath, job->frames, job->mismatchFrame, kinds + 1);
+    } else {
+      fprintf(
+        report, "%d %s %d ok %016llx %016llx %016llx %.3f\n", i, job->romPath, job->frames,
+        (unsigned long long) job->frameHash, (unsigned long long) job->audioHash, (unsigned long long) job->stateHash, job->time
+      );
+    }
+  }
+  fprintf(
+    report, "# %d jobs, %d failed, %d mismatched, %d threads, %.3f seconds\n",
+    runner.jobCount, failed, mismatched, threads, totalTime
+  );
+  if(report != stdout) fclose(report);
+  // clean up
+  for(int i = 0; i < threads; i++) {
+    pthread_mutex_destroy(&runner.queues[i].lock);
+    free(runner.queues[i].jobs);
+  }
+  for(int i = 0; i < runner.jobCount; i++) {
+    if(runner.jobs[i].ownsRom) snes_releaseRom(runner.jobs[i].rom);
+    free(runner.jobs[i].romPath);
+    free(runner.jobs[i].moviePath);
+    free(runner.jobs[i].framePath);
+    free(runner.jobs[i].audioPath);
+    free(runner.jobs[i].hashPath);
+    free(runner.jobs[i].expectPath);
+  }
+  free(runner.queues);
+  free(runner.workers);
+  free(runner.jobs);
+  return failed + mismatched > 0 ? 2 : 0;
+}
+
+static bool readJobs(BatchRunner* runner, const char* path) {
+  FILE* f = fopen(path, "r");
+  if(f == NULL) return false;
+  int capacity = 16;
+  runner->jobs = malloc(capacity * sizeof(BatchJob));
+  runner->jobCount = 0;
+  char line[1024];
+  while(fgets(line, sizeof(line), f) != NULL) {
+    char* token = strtok(line, " \t\r\n");
+    if(token == NULL || token[0] == '#') continue;
+    if(runner->jobCount == capacity) {
+      capacity *= 2;
+      runner->jobs = realloc(runner->jobs, capacity * sizeof(BatchJob));
+    }
+    BatchJob* job = &runner->jobs[runner->jobCount++];
+    memset(job, 0, sizeof(BatchJob));
+    job->romPath = strdup(token);
+    token = strtok(NULL, " \t\r\n");
+    job->frames = token != NULL ? atoi(token) : 0;
+    while((token = strtok(NULL, " \t\r\n")) != NULL) {
+      if(strncmp(token, "movie=", 6) == 0) {
+        job->moviePath = strdup(token + 6);
+      } else if(strncmp(token, "frame=", 6) == 0) {
+        job->framePath = strdup(token + 6);
+      } else if(strncmp(token, "audio=", 6) == 0) {
+        job->audioPath = strdup(token + 6);
+      } else if(strncmp(token, "hashes=", 7) == 0) {
+        job->hashPath = strdup(token + 7);
+      } else if(strncmp(token, "expect=", 7) == 0) {
+        job->expectPath = strdup(token + 7);
+      }
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+static void loadRoms(BatchRunner* runner) {
+  for(int i = 0; i < runner->jobCount; i++) {
+    BatchJob* job = &runner->jobs[i];
+    for(int j = 0; j < i; j++) {
+      if(strcmp(runner->jobs[j].romPath, job->romPath) == 0) {
+        job->rom = runner->jobs[j].rom;
+        break;
+      }
+    }
+    if(job->rom == NULL) {
+      job->rom = snes_openRom(job->romPath);
+      job->ownsRom = job->rom != NULL;
+    }
+  }
+}
+
+static void* runWorker(void* data) {
+  Worker* worker = data;
+  int job = 0;
+  while(takeJob(worker->runner, worker->index, &job)) {
+    runJob(&worker->runner->jobs[job]);
+  }
+  return NULL;
+}
+
+static bool takeJob(BatchRunner* runner, int worker, int* job) {
+  // take from the back of our own queue first
+  JobQueue* queue = &runner->queues[worker];
+  pthread_mutex_lock(&queue->lock);
+  bool found = queue->back > queue->front;
+  if(found) *job = queue->jobs[--queue->back];
+  pthread_mutex_unlock(&queue->lock);
+  if(found) return true;
+  // else steal from the front of another queue, jobs are never added so all being empty means we are done
+  for(int i = 1; i < runner->workerCount; i++) {
+    queue = &runner->queues[(worker + i) % runner->workerCount];
+    pthread_mutex_lock(&queue->lock);
+    found = queue->back > queue->front;
+    if(found) *job = queue->jobs[queue->front++];
+    pthread_mutex_unlock(&queue->lock);
+    if(found) return true;
+  }
+  return false;
+}
+
+static void runJob(BatchJob* job) {
+  double startTime = getTime();
+  job->failed = true;
+  job->mismatchFrame = -1;
+  if(job->rom == NULL) {
+    job->error = "failed to load rom";
+    return;
+  }
+  Snes* snes = snes_init();
+  uint8_t* pixels = calloc(512 * 480 * 4, 1); // cleared, for jobs that run no frames
+  int16_t* samples = malloc(960 * 4); // enough for pal
+  int16_t* nativeSamples = malloc(0x400 * 4);
+  FILE* audio = NULL;
+  FILE* hashes = NULL;
+  uint64_t* expected = NULL;
+  int expectedFrames = 0;
+  Movie* movie = movie_init(snes);
+  snes_attachRom(snes, job->rom);
+  if(job->moviePath != NULL) {
+    int length = 0;
+    uint8_t* movieData = readFile(job->moviePath, &length);
+    bool loaded = movieData != NULL && movie_load(movie, movieData, length) && movie_startPlayback(movie);
+    free(movieData);
+    if(!loaded) {
+      job->error = "failed to load movie";
+      goto cleanup;
+    }
+    if(job->frames == 0) job->frames = movie->frameCount;
+  }
+  if(job->audioPath != NULL && (audio = fopen(job->audioPath, "wb")) == NULL) {
+    job->error = "failed to open audio output";
+    goto cleanup;
+  }
+  if(job->hashPath != NULL && (hashes = fopen(job->hashPath, "w")) == NULL) {
+    job->error = "failed to open hashes output";
+    goto cleanup;
+  }
+  if(job->expectPath != NULL && (expected = readHashes(job->expectPath, &expectedFrames)) == NULL) {
+    job->error = "failed to read expected hashes";
+    goto cleanup;
+  }
+  snes_setPixelFormat(snes, pixelFormatXRGB);
+  snes_setPixelBuffer(snes, pixels, 512 * 4, false);
+  int samplesPerFrame = snes->palTiming ? 960 : 800; // 48000 Hz
+  bool perFrame = hashes != NULL || expected != NULL;
+  uint16_t samplePosition = 0;
+  snes_getNativeSamples(snes, nativeSamples, &samplePosition); // start from the current position
+  uint64_t audioHash = 0xcbf29ce484222325;
+  int width = 0, height = 0;
+  for(int i = 0; i < job->frames; i++) {
+    // only the final frame is rendered, unless per-frame hashes are needed
+    snes_setRenderSkip(snes, !perFrame && i < job->frames - 1);
+    snes_runFrame(snes);
+    int nativeCount = snes_getNativeSamples(snes, nativeSamples, &samplePosition);
+    audioHash = hashData(audioHash, (uint8_t*) nativeSamples, nativeCount * 4);
+    if(audio != NULL) {
+      snes_setSamples(snes, samples, samplesPerFrame);
+      fwrite(samples, samplesPerFrame * 4, 1, audio);
+    }
+    if(!perFrame) continue;
+    snes_getPixelSize(snes, &width, &height);
+    uint64_t videoFrameHash = 0xcbf29ce484222325;
+    for(int y = 0; y < height; y++) videoFrameHash = hashData(videoFrameHash, pixels + y * 512 * 4, width * 4);
+    uint64_t audioFrameHash = hashData(0xcbf29ce484222325, (uint8_t*) nativeSamples, nativeCount * 4);
+    uint64_t stateFrameHash = snes_hashState(snes);
+    if(hashes != NULL) {
+      fprintf(
+        hashes, "%d %016llx %016llx %016llx\n", i,
+        (unsigned long long) videoFrameHash, (unsigned long long) audioFrameHash, (unsigned long long) stateFrameHash
+      );
+    }
+    if(expected != NULL && job->mismatchFrame < 0) {
+      job->videoMismatch = i >= expectedFrames || expected[i * 3] != videoFrameHash;
+      job->audioMismatch = i >= expectedFrames || expected[i * 3 + 1] != audioFrameHash;
+      job->stateMismatch = i >= expectedFrames || expected[i * 3 + 2] != stateFrameHash;
+      if(job->videoMismatch || job->audioMismatch || job->stateMismatch) {
+        job->mismatchFrame = i;
+        // no need to continue, unless the hashes are being written
+        if(hashes == NULL) break;
+      }
+    }
+  }
+  if(expected != NULL && job->mismatchFrame < 0 && expectedFrames > job->frames) {
+    // ran fewer frames than expected, the first missing frame differs in everything (like extra frames do)
+    job->videoMismatch = job->audioMismatch = job->stateMismatch = true;
+    job->mismatchFrame = job->frames;
+  }
+  snes_getPixelSize(snes, &width, &height);
+  uint64_t frameHash = 0xcbf29ce484222325;
+  for(int y = 0; y < height; y++) frameHash = hashData(frameHash, pixels + y * 512 * 4, width * 4);
+  job->stateHash = snes_hashState(snes);
+  job->frameHash = frameHash;
+  job->audioHash = audioHash;
+  if(job->framePath != NULL && !writePpm(job->framePath, pixels, width, height, 512 * 4)) {
+    job->error = "failed to write frame";
+    goto cleanup;
+  }
+  job->failed = false;
+  cleanup:
+  if(audio != NULL) fclose(audio);
+  if(hashes != NULL) fclose(hashes);
+  free(expected);
+  movie_free(movie);
+  free(nativeSamples);
+  free(samples);
+  free(pixels);
+  snes_free(snes);
+  job->time = getTime() - startTime;
+}
+
+static uint8_t* readFile(const char* name, int* length) {
+  FILE* f = fopen(name, "rb");
+  if(f == NULL) return NULL;
+  fseek(f, 0, SEEK_END);
+  int size = ftell(f);
+  rewind(f);
+  uint8_t* buffer = malloc(size);
+  if(fread(buffer, size, 1, f) != 1) {
+    fclose(f);
+    free(buffer);
+    return NULL;
+  }
+  fclose(f);
+  *length = size;
+  return buffer;
+}
+
+static uint64_t* readHashes(const char* path, int* frames) {
+  // reads a file as written for hashes=, returns 3 hashes (video, audio, state) per frame
+  // returns NULL if it can't be read, or if a line is invalid or out of order
+  FILE* f = fopen(path, "r");
+  if(f == NULL) return NULL;
+  int capacity = 1024;
+  uint64_t* hashes = malloc(capacity * 3 * sizeof(uint64_t));
+  *frames = 0;
+  int frame = 0;
+  unsigned long long video = 0, audio = 0, state = 0;
+  int count = 0;
+  while((count = fscanf(f, "%d %llx %llx %llx", &frame, &video, &audio, &state)) == 4) {
+    if(frame != *frames) break; // not in order
+    if(*frames == capacity) {
+      capacity *= 2;
+      hashes = realloc(hashes, capacity * 3 * sizeof(uint64_t));
+    }
+    hashes[*frames * 3] = video;
+    hashes[*frames * 3 + 1] = audio;
+    hashes[*frames * 3 + 2] = state;
+    (*frames)++;
+  }
+  fclose(f);
+  if(count != EOF) {
+    // stopped before the end
+    free(hashes);
+    return NULL;
+  }
+  return hashes;
+}
+
+static bool writePpm(const char* path, const uint8_t* pixels, int width, int height, int pitch) {
+  // pixels are in xrgb format (bgrx in memory)
+  FILE* f = fopen(path, "wb");
+  if(f == NULL) return false;
+  fprintf(f, "P6\n%d %d\n255\n", width, height);
+  uint8_t* line = malloc(width * 3);
+  for(int y = 0; y < height; y++) {
+    for(int x = 0; x < width; x++) {
+      const uint8_t* pixel = pixels + y * pitch + x * 4;
+      line[x * 3] = pixel[2];
+      line[x * 3 + 1] = pixel[1];
+      line[x * 3 + 2] = pixel[0];
+    }
+    fwrite(line, width * 3, 1, f);
+  }
+  free(line);
+  fclose(f);
+  return true;
+}
+
+static uint64_t hashData(uint64_t hash, const uint8_t* data, int length) {
+  // 64-bit FNV-1a, start with 0xcbf29ce484222325
+  for(int i = 0; i < length; i++) {
+    hash ^= data[i];
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+static double getTime(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1000000000.0;
+}
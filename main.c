@@ -18,6 +18,11 @@
 #include "zip.h"
 
 #include "snes.h"
+#include "rewindbuffer.h"
+#include "movie.h"
+#include "trace.h"
+#include "profiler.h"
+#include "cdl.h"
 #include "tracing.h"
 
 /* depends on behaviour:
@@ -43,6 +48,9 @@ static struct {
   SDL_Window* window;
   SDL_Renderer* renderer;
   SDL_Texture* texture;
+  uint8_t* pixelBuffer;
+  int frameWidth;
+  int frameHeight;
   // audio
   SDL_AudioDeviceID audioDevice;
   int audioFrequency;
@@ -52,6 +60,16 @@ static struct {
   char* pathSeparator;
   // snes, timing
   Snes* snes;
+  RewindBuffer* rewindBuffer;
+  Movie* movie;
+  Trace* trace; // allocated when first used
+  bool tracing;
+  Profiler* profiler;
+  bool profiling;
+  Cdl* cdl;
+  bool logging;
+  int runAheadFrames;
+  uint8_t* runAheadState;
   float wantedFrames;
   int wantedSamples;
   // loaded rom
@@ -59,11 +77,15 @@ static struct {
   char* romName;
   char* savePath;
   char* statePath;
+  char* moviePath;
+  char* profilePath;
+  char* cdlPath;
 } glb = {};
 
 static uint8_t* readFile(const char* name, int* length);
 static void loadRom(const char* path);
 static void closeRom(void);
+static void saveCdl(void);
 static void setPaths(const char* path);
 static void setTitle(const char* path);
 static bool checkExtention(const char* name, bool forZip);
@@ -139,12 +161,28 @@ int main(int argc, char** argv) {
   );
   // init snes, load rom
   glb.snes = snes_init();
+  glb.pixelBuffer = malloc(512 * 480 * 4); // 4 (rgba) * 512 (w) * 480 (h)
+  memset(glb.pixelBuffer, 0, 512 * 480 * 4);
+  glb.frameWidth = 256;
+  glb.frameHeight = 224;
+  snes_setPixelBuffer(glb.snes, glb.pixelBuffer, 512 * 4, true);
+  glb.rewindBuffer = rb_init(glb.snes, 64 * 1024 * 1024, 60); // 64 MB, keyframe every second
+  glb.movie = movie_init(glb.snes);
+  glb.trace = NULL;
+  glb.tracing = false;
+  glb.profiler = profiler_init(21477); // about 1000 samples per second
+  glb.profiling = false;
+  glb.cdl = cdl_init();
+  glb.logging = false;
   glb.wantedFrames = 1.0 / 60.0;
   glb.wantedSamples = glb.audioFrequency / 60;
   glb.loaded = false;
   glb.romName = NULL;
   glb.savePath = NULL;
   glb.statePath = NULL;
+  glb.moviePath = NULL;
+  glb.profilePath = NULL;
+  glb.cdlPath = NULL;
   if(argc >= 2) {
     loadRom(argv[1]);
   } else {
@@ -155,6 +193,7 @@ int main(int argc, char** argv) {
   bool paused = false;
   bool runOne = false;
   bool turbo = false;
+  bool rewinding = false;
   SDL_Event event;
   int fullscreenFlags = 0;
   // timing
@@ -172,6 +211,12 @@ int main(int argc, char** argv) {
             case SDLK_o: runOne = true; break;
             case SDLK_p: paused = !paused; break;
             case SDLK_t: turbo = true; break;
+            case SDLK_BACKSPACE: rewinding = true; break;
+            case SDLK_u: {
+              glb.runAheadFrames = (glb.runAheadFrames + 1) % 4;
+              printf("Run-ahead: %d frames\n", glb.runAheadFrames);
+              break;
+            }
             case SDLK_j: {
               char* filePath = malloc(strlen(glb.prefPath) + 9); // "dump.bin" (8) + '\0'
               strcpy(filePath, glb.prefPath);
@@ -241,6 +286,122 @@ int main(int argc, char** argv) {
               }
               break;
             }
+            case SDLK_v: {
+              // start recording movie, or stop and save it
+              if(!glb.loaded) break;
+              if(!glb.movie->recording) {
+                movie_startRecording(glb.movie, false);
+                puts("Recording movie from power-on");
+                break;
+              }
+              movie_stop(glb.movie);
+              int size = movie_save(glb.movie, NULL);
+              uint8_t* movieData = malloc(size);
+              movie_save(glb.movie, movieData);
+              FILE* f = fopen(glb.moviePath, "wb");
+              if(f != NULL) {
+                fwrite(movieData, size, 1, f);
+                fclose(f);
+                printf("Saved movie (%d frames)\n", glb.movie->frameCount);
+              } else {
+                puts("Failed to save movie");
+              }
+              free(movieData);
+              break;
+            }
+            case SDLK_b: {
+              // load and play movie
+              if(!glb.loaded) break;
+              int size = 0;
+              uint8_t* movieData = readFile(glb.moviePath, &size);
+              if(movieData != NULL) {
+                if(movie_load(glb.movie, movieData, size) && movie_startPlayback(glb.movie)) {
+                  printf("Playing movie (%d frames)\n", glb.movie->frameCount);
+                } else {
+                  puts("Failed to play movie, file contents invalid");
+                }
+                free(movieData);
+              } else {
+                puts("Failed to play movie, failed to read file");
+              }
+              break;
+            }
+            case SDLK_i: {
+              // start tracing, or stop and save the trace
+              if(!glb.tracing) {
+                if(glb.trace == NULL) glb.trace = trace_init(1024 * 1024); // 1M opcodes, 32 MB
+                if(snes_startTrace(glb.snes, glb.trace, true, true)) {
+                  glb.tracing = true;
+                  puts("Tracing CPU and SPC");
+                } else {
+                  puts("Tracing not available, build with -D LAKESNES_TRACE");
+                }
+                break;
+              }
+              snes_stopTrace(glb.snes);
+              glb.tracing = false;
+              char* filePath = malloc(strlen(glb.prefPath) + 10); // "trace.bin" (9) + '\0'
+              strcpy(filePath, glb.prefPath);
+              strcat(filePath, "trace.bin");
+              int size = trace_save(glb.trace, NULL);
+              uint8_t* traceData = malloc(size);
+              trace_save(glb.trace, traceData);
+              FILE* f = fopen(filePath, "wb");
+              if(f != NULL) {
+                fwrite(traceData, size, 1, f);
+                fclose(f);
+                printf("Saved trace to %s\n", filePath);
+              } else {
+                puts("Failed to save trace");
+              }
+              free(traceData);
+              free(filePath);
+              break;
+            }
+            case SDLK_f: {
+              // start profiling, or stop and save the profile
+              if(!glb.loaded) break;
+              if(!glb.profiling) {
+                snes_startProfile(glb.snes, glb.profiler);
+                glb.profiling = true;
+                puts("Profiling");
+                break;
+              }
+              snes_stopProfile(glb.snes);
+              glb.profiling = false;
+              int size = profiler_writeFolded(glb.profiler, NULL);
+              char* profileData = malloc(size);
+              profiler_writeFolded(glb.profiler, profileData);
+              FILE* f = fopen(glb.profilePath, "wb");
+              if(f != NULL) {
+                fwrite(profileData, size, 1, f);
+                fclose(f);
+                printf("Saved profile (%llu samples)\n", (unsigned long long) glb.profiler->samples);
+              } else {
+                puts("Failed to save profile");
+              }
+              free(profileData);
+              break;
+            }
+            case SDLK_g: {
+              // start code/data logging (merging in the saved log), or stop and save the log
+              if(!glb.loaded) break;
+              if(!glb.logging) {
+                snes_startCdl(glb.snes, glb.cdl);
+                glb.logging = true;
+                int size = 0;
+                uint8_t* cdlData = readFile(glb.cdlPath, &size);
+                if(cdlData != NULL) {
+                  puts(cdl_load(glb.cdl, cdlData, size) ? "Logging (loaded saved log)" : "Logging (saved log not valid for this rom)");
+                  free(cdlData);
+                } else {
+                  puts("Logging");
+                }
+                break;
+              }
+              saveCdl();
+              break;
+            }
             case SDLK_RETURN: {
               if(event.key.keysym.mod & KMOD_ALT) {
                 fullscreenFlags ^= SDL_WINDOW_FULLSCREEN_DESKTOP;
@@ -258,6 +419,7 @@ int main(int argc, char** argv) {
         case SDL_KEYUP: {
           switch(event.key.keysym.sym) {
             case SDLK_t: turbo = false; break;
+            case SDLK_BACKSPACE: rewinding = false; break;
           }
           handleInput(event.key.keysym.sym, false);
           break;
@@ -286,31 +448,61 @@ int main(int argc, char** argv) {
       // run frame
       if(glb.loaded && (!paused || runOne)) {
         runOne = false;
-        if(turbo) {
+        if(rewinding) {
+          // go back to the state before the last frame, and run it again to show it
+          rb_step(glb.rewindBuffer);
+          snes_runFrame(glb.snes);
+        } else {
+          if(turbo) {
+            snes_setRenderSkip(glb.snes, true);
+            snes_runFrame(glb.snes);
+            snes_setRenderSkip(glb.snes, false);
+            rb_push(glb.rewindBuffer);
+          }
+          // with run-ahead, the frame shown is rendered by snes_runAhead
+          snes_setRenderSkip(glb.snes, glb.runAheadFrames > 0);
           snes_runFrame(glb.snes);
+          snes_setRenderSkip(glb.snes, false);
+          rb_push(glb.rewindBuffer);
         }
-        snes_runFrame(glb.snes);
         playAudio();
+        if(glb.runAheadFrames > 0 && !rewinding) {
+          snes_runAhead(glb.snes, glb.runAheadFrames, glb.runAheadState);
+        }
         renderScreen();
       }
     }
 
+    // frame is 256 or 512 wide, and 224/239 lines, or twice that if interlaced
+    int height = glb.frameHeight < 240 ? glb.frameHeight * 2 : glb.frameHeight;
+    SDL_Rect srcRect = {0, 0, glb.frameWidth, glb.frameHeight};
+    SDL_Rect destRect = {0, (480 - height) / 2, 512, height};
     SDL_RenderClear(glb.renderer);
-    SDL_RenderCopy(glb.renderer, glb.texture, NULL, NULL);
+    SDL_RenderCopy(glb.renderer, glb.texture, &srcRect, &destRect);
     SDL_RenderPresent(glb.renderer); // should vsync
   }
   // close rom (saves battery)
   closeRom();
   // free snes
+  rb_free(glb.rewindBuffer);
+  movie_free(glb.movie);
+  if(glb.trace != NULL) trace_free(glb.trace);
+  profiler_free(glb.profiler);
+  cdl_free(glb.cdl);
   snes_free(glb.snes);
   // clean sdl and free global allocs
   SDL_PauseAudioDevice(glb.audioDevice, 1);
   SDL_CloseAudioDevice(glb.audioDevice);
   free(glb.audioBuffer);
+  free(glb.pixelBuffer);
+  free(glb.runAheadState);
   SDL_free(glb.prefPath);
   if(glb.romName) free(glb.romName);
   if(glb.savePath) free(glb.savePath);
   if(glb.statePath) free(glb.statePath);
+  if(glb.moviePath) free(glb.moviePath);
+  if(glb.profilePath) free(glb.profilePath);
+  if(glb.cdlPath) free(glb.cdlPath);
   SDL_DestroyTexture(glb.texture);
   SDL_DestroyRenderer(glb.renderer);
   SDL_DestroyWindow(glb.window);
@@ -327,17 +519,22 @@ static void playAudio() {
 }
 
 static void renderScreen() {
-  void* pixels = NULL;
-  int pitch = 0;
-  if(SDL_LockTexture(glb.texture, NULL, &pixels, &pitch) != 0) {
-    printf("Failed to lock texture: %s\n", SDL_GetError());
-    return;
+  // the frame has been rendered into the pixel buffer, upload the lines that changed
+  snes_getPixelSize(glb.snes, &glb.frameWidth, &glb.frameHeight);
+  int firstLines[16];
+  int lineCounts[16];
+  int ranges = snes_getChangedLines(glb.snes, firstLines, lineCounts, 16);
+  for(int i = 0; i < ranges; i++) {
+    SDL_Rect rect = {0, firstLines[i], glb.frameWidth, lineCounts[i]};
+    if(SDL_UpdateTexture(glb.texture, &rect, glb.pixelBuffer + firstLines[i] * 512 * 4, 512 * 4) != 0) {
+      printf("Failed to update texture: %s\n", SDL_GetError());
+    }
   }
-  snes_setPixels(glb.snes, (uint8_t*) pixels);
-  SDL_UnlockTexture(glb.texture);
 }
 
 static void handleInput(int keyCode, bool pressed) {
+  // ignored while playing a movie, as games reading the controllers manually would see it between frames
+  if(glb.movie->playing) return;
   switch(keyCode) {
     case SDLK_z: snes_setButtonState(glb.snes, 1, 0, pressed); break;
     case SDLK_a: snes_setButtonState(glb.snes, 1, 1, pressed); break;
@@ -399,7 +596,15 @@ static void loadRom(const char* path) {
   // close currently loaded rom (saves battery)
   closeRom();
   // load new rom
+  movie_stop(glb.movie);
+  if(glb.profiling) {
+    snes_stopProfile(glb.snes);
+    glb.profiling = false;
+    puts("Stopped profiling");
+  }
   if(snes_loadRom(glb.snes, file, length)) {
+    rb_clear(glb.rewindBuffer);
+    glb.runAheadState = realloc(glb.runAheadState, snes_saveState(glb.snes, NULL));
     // get rom name and paths, set title
     setPaths(path);
     setTitle(glb.romName);
@@ -424,6 +629,8 @@ static void loadRom(const char* path) {
 
 static void closeRom() {
   if(!glb.loaded) return;
+  if(glb.logging) saveCdl();
+  movie_stop(glb.movie); // puts back the battery ram from before a movie
   int size = snes_saveBattery(glb.snes, NULL);
   if(size > 0) {
     uint8_t* saveData = malloc(size);
@@ -440,6 +647,24 @@ static void closeRom() {
   }
 }
 
+static void saveCdl() {
+  // stops logging and saves the log
+  snes_stopCdl(glb.snes);
+  glb.logging = false;
+  int size = cdl_save(glb.cdl, NULL);
+  uint8_t* cdlData = malloc(size);
+  cdl_save(glb.cdl, cdlData);
+  FILE* f = fopen(glb.cdlPath, "wb");
+  if(f != NULL) {
+    fwrite(cdlData, size, 1, f);
+    fclose(f);
+    puts("Saved code/data log");
+  } else {
+    puts("Failed to save code/data log");
+  }
+  free(cdlData);
+}
+
 static void setPaths(const char* path) {
   // get rom name
   if(glb.romName) free(glb.romName);
@@ -470,6 +695,30 @@ static void setPaths(const char* path) {
   strcat(glb.statePath, glb.pathSeparator);
   strncat(glb.statePath, glb.romName, strlen(glb.romName) - extLen); // cut off extension
   strcat(glb.statePath, ".lss");
+  // get movie name
+  if(glb.moviePath) free(glb.moviePath);
+  glb.moviePath = malloc(strlen(glb.prefPath) + strlen(glb.romName) + 12); // "states/" (7) + ".lsm" (4) + '\0'
+  strcpy(glb.moviePath, glb.prefPath);
+  strcat(glb.moviePath, "states");
+  strcat(glb.moviePath, glb.pathSeparator);
+  strncat(glb.moviePath, glb.romName, strlen(glb.romName) - extLen); // cut off extension
+  strcat(glb.moviePath, ".lsm");
+  // get profile name
+  if(glb.profilePath) free(glb.profilePath);
+  glb.profilePath = malloc(strlen(glb.prefPath) + strlen(glb.romName) + 15); // "states/" (7) + ".folded" (7) + '\0'
+  strcpy(glb.profilePath, glb.prefPath);
+  strcat(glb.profilePath, "states");
+  strcat(glb.profilePath, glb.pathSeparator);
+  strncat(glb.profilePath, glb.romName, strlen(glb.romName) - extLen); // cut off extension
+  strcat(glb.profilePath, ".folded");
+  // get code/data log name
+  if(glb.cdlPath) free(glb.cdlPath);
+  glb.cdlPath = malloc(strlen(glb.prefPath) + strlen(glb.romName) + 12); // "states/" (7) + ".cdl" (4) + '\0'
+  strcpy(glb.cdlPath, glb.prefPath);
+  strcat(glb.cdlPath, "states");
+  strcat(glb.cdlPath, glb.pathSeparator);
+  strncat(glb.cdlPath, glb.romName, strlen(glb.romName) - extLen); // cut off extension
+  strcat(glb.cdlPath, ".cdl");
 }
 
 static void setTitle(const char* romName) {
@@ -19,26 +19,23 @@ static const uint8_t bootRom[0x40] = {
 };
 
 static void apu_cycle(Apu* apu);
+static void apu_logSpcRead(Apu* apu, uint16_t adr);
 
-Apu* apu_init(Snes* snes) {
-  Apu* apu = malloc(sizeof(Apu));
+void apu_init(Apu* apu, Snes* snes, Spc* spc, Dsp* dsp, uint8_t* ram) {
+  // ram is 64K
   apu->snes = snes;
-  apu->spc = spc_init(apu, apu_spcRead, apu_spcWrite, apu_spcIdle);
-  apu->dsp = dsp_init(apu);
-  return apu;
-}
-
-void apu_free(Apu* apu) {
-  spc_free(apu->spc);
-  dsp_free(apu->dsp);
-  free(apu);
+  apu->spc = spc;
+  apu->dsp = dsp;
+  apu->ram = ram;
+  spc_init(spc, apu, apu_spcRead, apu_spcWrite, apu_spcIdle);
+  dsp_init(dsp, apu);
 }
 
 void apu_reset(Apu* apu) {
   // TODO: hard reset for apu
   spc_reset(apu->spc, true);
   dsp_reset(apu->dsp);
-  memset(apu->ram, 0, sizeof(apu->ram));
+  memset(apu->ram, 0, 0x10000);
   apu->dspAdr = 0;
   apu->romReadable = true;
   apu->cycles = 0;
@@ -64,7 +61,7 @@ void apu_handleState(Apu* apu, StateHandler* sh) {
     sh_handleBools(sh, &apu->timer[i].enabled, NULL);
     sh_handleBytes(sh, &apu->timer[i].cycles, &apu->timer[i].divider, &apu->timer[i].target, &apu->timer[i].counter, NULL);
   }
-  sh_handleByteArray(sh, apu->ram, 0x10000);
+  sh_handleDirtyByteArray(sh, apu->ram, 0x10000, apu->ramDirty);
   // components
   spc_handleState(apu->spc, sh);
   dsp_handleState(apu->dsp, sh);
@@ -73,10 +70,15 @@ void apu_handleState(Apu* apu, StateHandler* sh) {
 int apu_runCycles(Apu* apu, int wantedCycles) {
   int runCycles = 0;
   uint32_t startCycles = apu->cycles;
+  Profiler* profiler = apu->snes->profiler;
   while(runCycles < wantedCycles) {
     spc_runOpcode(apu->spc);
     runCycles += (uint32_t) (apu->cycles - startCycles);
     startCycles = apu->cycles;
+    // (if the cycle count went back, this samples right away and continues from there)
+    if(profiler != NULL && apu->cycles - profiler->lastSpcSample >= profiler->spcInterval) {
+      profiler_sampleSpc(profiler, apu->cycles);
+    }
   }
   return runCycles;
 }
@@ -107,6 +109,8 @@ static void apu_cycle(Apu* apu) {
 }
 
 uint8_t apu_read(Apu* apu, uint16_t adr) {
+  // plain ram (everything but the registers and the boot rom) skips the register decode
+  if((adr & 0xfff0) != 0xf0 && adr < 0xffc0) return apu->ram[adr];
   switch(adr) {
     case 0xf0:
     case 0xf1:
@@ -144,6 +148,12 @@ uint8_t apu_read(Apu* apu, uint16_t adr) {
 }
 
 void apu_write(Apu* apu, uint16_t adr, uint8_t val) {
+  if((adr & 0xfff0) != 0xf0) {
+    // plain ram, writes to the boot rom area always go to ram
+    apu->ram[adr] = val;
+    apu->ramDirty[adr >> 8] = true;
+    return;
+  }
   switch(adr) {
     case 0xf0: {
       break; // test register
@@ -195,11 +205,13 @@ void apu_write(Apu* apu, uint16_t adr, uint8_t val) {
     }
   }
   apu->ram[adr] = val;
+  apu->ramDirty[adr >> 8] = true;
 }
 
 uint8_t apu_spcRead(void* mem, uint16_t adr) {
   Apu* apu = (Apu*) mem;
   apu_cycle(apu);
+  if(apu->snes->cdl != NULL) apu_logSpcRead(apu, adr);
   return apu_read(apu, adr);
 }
 
@@ -213,3 +225,17 @@ void apu_spcIdle(void* mem, bool waiting) {
   Apu* apu = (Apu*) mem;
   apu_cycle(apu);
 }
+
+static void apu_logSpcRead(Apu* apu, uint16_t adr) {
+  // same as for the cpu: reads after the opcode and before the pc are operands, reads at the pc are dummy reads
+  // registers and the boot rom are not aram
+  if(adr == apu->spc->pc || (adr >= 0xf0 && adr < 0x100) || (apu->romReadable && adr >= 0xffc0)) return;
+  Cdl* cdl = apu->snes->cdl;
+  uint8_t flag = cdlSpcData;
+  if(adr == cdl->spcOpcodeAdr) {
+    flag = cdlSpcOpcode;
+  } else if((uint16_t) (adr - cdl->spcOpcodeAdr) < 3 && (uint16_t) (adr - cdl->spcOpcodeAdr) < (uint16_t) (apu->spc->pc - cdl->spcOpcodeAdr)) {
+    flag = cdlSpcOperand;
+  }
+  cdl->aram[adr] |= flag;
+}
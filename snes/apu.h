@@ -24,17 +24,17 @@ struct Apu {
   Snes* snes;
   Spc* spc;
   Dsp* dsp;
-  uint8_t ram[0x10000];
   bool romReadable;
   uint8_t dspAdr;
   uint32_t cycles;
   uint8_t inPorts[6]; // includes 2 bytes of ram
   uint8_t outPorts[4];
   Timer timer[3];
+  uint8_t* ram; // 64K, placed at the end of the snes memory
+  bool ramDirty[0x100]; // per 256-byte page
 };
 
-Apu* apu_init(Snes* snes);
-void apu_free(Apu* apu);
+void apu_init(Apu* apu, Snes* snes, Spc* spc, Dsp* dsp, uint8_t* ram);
 void apu_reset(Apu* apu);
 void apu_handleState(Apu* apu, StateHandler* sh);
 int apu_runCycles(Apu* apu, int wantedCycles);
@@ -9,27 +9,31 @@
 #include "snes.h"
 #include "statehandler.h"
 
+static inline uint8_t cart_readRom(Cart* cart, uint32_t adr);
 static uint8_t cart_readLorom(Cart* cart, uint8_t bank, uint16_t adr);
 static void cart_writeLorom(Cart* cart, uint8_t bank, uint16_t adr, uint8_t val);
 static uint8_t cart_readHirom(Cart* cart, uint8_t bank, uint16_t adr);
 static uint8_t cart_readExHirom(Cart* cart, uint8_t bank, uint16_t adr);
 static void cart_writeHirom(Cart* cart, uint8_t bank, uint16_t adr, uint8_t val);
+static void cart_releaseRom(Cart* cart);
+static int cart_getMirroredOffset(Cart* cart, uint32_t adr);
 
-Cart* cart_init(Snes* snes) {
-  Cart* cart = malloc(sizeof(Cart));
+void cart_init(Cart* cart, Snes* snes) {
   cart->snes = snes;
   cart->type = 0;
   cart->rom = NULL;
   cart->romSize = 0;
+  cart->romPages = NULL;
+  cart->romImage = NULL;
   cart->ram = NULL;
   cart->ramSize = 0;
-  return cart;
+  cart->ramDirty = NULL;
 }
 
 void cart_free(Cart* cart) {
-  if(cart->rom != NULL) free(cart->rom);
+  cart_releaseRom(cart);
   if(cart->ram != NULL) free(cart->ram);
-  free(cart);
+  if(cart->ramDirty != NULL) free(cart->ramDirty);
 }
 
 void cart_reset(Cart* cart) {
@@ -53,23 +57,65 @@ bool cart_handleTypeState(Cart* cart, StateHandler* sh) {
 }
 
 void cart_handleState(Cart* cart, StateHandler* sh) {
-  if(cart->ram != NULL) sh_handleByteArray(sh, cart->ram, cart->ramSize);
+  if(cart->ram != NULL) sh_handleDirtyByteArray(sh, cart->ram, cart->ramSize, cart->ramDirty);
 }
 
-void cart_load(Cart* cart, int type, uint8_t* rom, int romSize, int ramSize) {
+void cart_load(Cart* cart, int type, RomImage* rom, int ramSize) {
   cart->type = type;
-  if(cart->rom != NULL) free(cart->rom);
+  rom_retain(rom); // before releasing, in case it is the same image
+  cart_releaseRom(cart);
   if(cart->ram != NULL) free(cart->ram);
-  cart->rom = malloc(romSize);
-  cart->romSize = romSize;
+  if(cart->ramDirty != NULL) free(cart->ramDirty);
+  cart->romImage = rom;
+  cart->rom = rom->data;
+  cart->romSize = rom->mirroredSize;
+  cart->romPages = rom->pages;
   if(ramSize > 0) {
     cart->ram = malloc(ramSize);
     memset(cart->ram, 0, ramSize);
+    cart->ramDirty = malloc((ramSize + 0xff) >> 8);
+    memset(cart->ramDirty, true, (ramSize + 0xff) >> 8);
   } else {
     cart->ram = NULL;
+    cart->ramDirty = NULL;
   }
   cart->ramSize = ramSize;
-  memcpy(cart->rom, rom, romSize);
+}
+
+void cart_copyInto(Cart* cart, Cart* src) {
+  // the rom is shared, ram is copied
+  if(cart->romImage != src->romImage) {
+    if(src->romImage != NULL) rom_retain(src->romImage);
+    cart_releaseRom(cart);
+    cart->romImage = src->romImage;
+    cart->rom = src->rom;
+    cart->romPages = src->romPages;
+  }
+  cart->type = src->type;
+  cart->romSize = src->romSize;
+  if(cart->ramSize != src->ramSize || cart->ram == NULL) {
+    if(cart->ram != NULL) free(cart->ram);
+    if(cart->ramDirty != NULL) free(cart->ramDirty);
+    cart->ram = NULL;
+    cart->ramDirty = NULL;
+    if(src->ram != NULL) {
+      cart->ram = malloc(src->ramSize);
+      cart->ramDirty = malloc((src->ramSize + 0xff) >> 8);
+    }
+  }
+  cart->ramSize = src->ramSize;
+  if(src->ram != NULL) {
+    memcpy(cart->ram, src->ram, src->ramSize);
+    memcpy(cart->ramDirty, src->ramDirty, (src->ramSize + 0xff) >> 8);
+  }
+}
+
+static void cart_releaseRom(Cart* cart) {
+  if(cart->romImage == NULL) return;
+  rom_release(cart->romImage);
+  cart->rom = NULL;
+  cart->romPages = NULL;
+  cart->romImage = NULL;
 }
 
 bool cart_handleBattery(Cart* cart, bool save, uint8_t* data, int* size) {
@@ -81,7 +127,10 @@ bool cart_handleBattery(Cart* cart, bool save, uint8_t* data, int* size) {
     return true;
   } else {
     if(*size != cart->ramSize) return false;
-    if(cart->ram != NULL) memcpy(cart->ram, data, cart->ramSize);
+    if(cart->ram != NULL) {
+      memcpy(cart->ram, data, cart->ramSize);
+      memset(cart->ramDirty, true, (cart->ramSize + 0xff) >> 8);
+    }
     return true;
   }
 }
@@ -105,6 +154,36 @@ void cart_write(Cart* cart, uint8_t bank, uint16_t adr, uint8_t val) {
   }
 }
 
+int cart_getRomOffset(Cart* cart, uint8_t bank, uint16_t adr) {
+  // offset in the rom image that is read for this address, -1 if it does not read rom
+  switch(cart->type) {
+    case 1: {
+      if(((bank >= 0x70 && bank < 0x7e) || bank >= 0xf0) && adr < 0x8000 && cart->ramSize > 0) return -1;
+      bank &= 0x7f;
+      if(adr >= 0x8000 || bank >= 0x40) return cart_getMirroredOffset(cart, (bank << 15) | (adr & 0x7fff));
+      return -1;
+    }
+    case 2:
+    case 3: {
+      if((bank & 0x7f) < 0x40 && adr >= 0x6000 && adr < 0x8000 && cart->ramSize > 0) return -1;
+      bool secondHalf = cart->type == 3 && bank < 0x80;
+      bank &= 0x7f;
+      if(adr >= 0x8000 || bank >= 0x40) {
+        return cart_getMirroredOffset(cart, ((bank & 0x3f) << 16) | (secondHalf ? 0x400000 : 0) | adr);
+      }
+      return -1;
+    }
+  }
+  return -1;
+}
+
+static inline uint8_t cart_readRom(Cart* cart, uint32_t adr) {
+  // roms that are not a power of 2 in size are mirrored through the page offsets
+  adr &= cart->romSize - 1;
+  if(cart->romPages == NULL) return cart->rom[adr];
+  return cart->rom[cart->romPages[adr >> 12] | (adr & 0xfff)];
+}
+
 static uint8_t cart_readLorom(Cart* cart, uint8_t bank, uint16_t adr) {
   if(((bank >= 0x70 && bank < 0x7e) || bank >= 0xf0) && adr < 0x8000 && cart->ramSize > 0) {
     // banks 70-7e and f0-ff, adr 0000-7fff
@@ -113,7 +192,7 @@ static uint8_t cart_readLorom(Cart* cart, uint8_t bank, uint16_t adr) {
   bank &= 0x7f;
   if(adr >= 0x8000 || bank >= 0x40) {
     // adr 8000-ffff in all banks or all addresses in banks 40-7f and c0-ff
-    return cart->rom[((bank << 15) | (adr & 0x7fff)) & (cart->romSize - 1)];
+    return cart_readRom(cart, (bank << 15) | (adr & 0x7fff));
   }
   return cart->snes->openBus;
 }
@@ -121,7 +200,9 @@ static uint8_t cart_readLorom(Cart* cart, uint8_t bank, uint16_t adr) {
 static void cart_writeLorom(Cart* cart, uint8_t bank, uint16_t adr, uint8_t val) {
   if(((bank >= 0x70 && bank < 0x7e) || bank > 0xf0) && adr < 0x8000 && cart->ramSize > 0) {
     // banks 70-7e and f0-ff, adr 0000-7fff
-    cart->ram[(((bank & 0xf) << 15) | adr) & (cart->ramSize - 1)] = val;
+    uint32_t ramAdr = (((bank & 0xf) << 15) | adr) & (cart->ramSize - 1);
+    cart->ram[ramAdr] = val;
+    cart->ramDirty[ramAdr >> 8] = true;
   }
 }
 
@@ -133,7 +214,7 @@ static uint8_t cart_readHirom(Cart* cart, uint8_t bank, uint16_t adr) {
   }
   if(adr >= 0x8000 || bank >= 0x40) {
     // adr 8000-ffff in all banks or all addresses in banks 40-7f and c0-ff
-    return cart->rom[(((bank & 0x3f) << 16) | adr) & (cart->romSize - 1)];
+    return cart_readRom(cart, ((bank & 0x3f) << 16) | adr);
   }
   return cart->snes->openBus;
 }
@@ -147,7 +228,7 @@ static uint8_t cart_readExHirom(Cart* cart, uint8_t bank, uint16_t adr) {
   bank &= 0x7f;
   if(adr >= 0x8000 || bank >= 0x40) {
     // adr 8000-ffff in all banks or all addresses in banks 40-7f and c0-ff
-    return cart->rom[(((bank & 0x3f) << 16) | (secondHalf ? 0x400000 : 0) | adr) & (cart->romSize - 1)];
+    return cart_readRom(cart, ((bank & 0x3f) << 16) | (secondHalf ? 0x400000 : 0) | adr);
   }
   return cart->snes->openBus;
 }
@@ -156,6 +237,15 @@ static void cart_writeHirom(Cart* cart, uint8_t bank, uint16_t adr, uint8_t val)
   bank &= 0x7f;
   if(bank < 0x40 && adr >= 0x6000 && adr < 0x8000 && cart->ramSize > 0) {
     // banks 00-3f and 80-bf, adr 6000-7fff
-    cart->ram[(((bank & 0x3f) << 13) | (adr & 0x1fff)) & (cart->ramSize - 1)] = val;
+    uint32_t ramAdr = (((bank & 0x3f) << 13) | (adr & 0x1fff)) & (cart->ramSize - 1);
+    cart->ram[ramAdr] = val;
+    cart->ramDirty[ramAdr >> 8] = true;
   }
 }
+
+static int cart_getMirroredOffset(Cart* cart, uint32_t adr) {
+  // same mirroring as cart_readRom
+  adr &= cart->romSize - 1;
+  if(cart->romPages == NULL) return adr;
+  return cart->romPages[adr >> 12] | (adr & 0xfff);
+}
@@ -8,28 +8,34 @@
 typedef struct Cart Cart;
 
 #include "snes.h"
+#include "romimage.h"
 #include "statehandler.h"
 
 struct Cart {
   Snes* snes;
   uint8_t type;
 
-  uint8_t* rom;
-  uint32_t romSize;
+  const uint8_t* rom; // data of romImage
+  uint32_t romSize; // mirrored size, power of 2
+  const uint32_t* romPages; // offsets of the 4K pages, NULL if not mirrored
+  RomImage* romImage; // shared by cloned instances and carts loaded from the same image
   uint8_t* ram;
   uint32_t ramSize;
+  bool* ramDirty; // per 256-byte page
 };
 
 // TODO: how to handle reset & load?
 
-Cart* cart_init(Snes* snes);
-void cart_free(Cart* cart);
+void cart_init(Cart* cart, Snes* snes);
+void cart_free(Cart* cart); // releases rom, frees ram
 void cart_reset(Cart* cart); // will reset special chips etc, general reading is set up in load
 bool cart_handleTypeState(Cart* cart, StateHandler* sh);
 void cart_handleState(Cart* cart, StateHandler* sh);
-void cart_load(Cart* cart, int type, uint8_t* rom, int romSize, int ramSize); // loads rom, sets up ram buffer
+void cart_load(Cart* cart, int type, RomImage* rom, int ramSize); // uses rom (without copying), sets up ram buffer
+void cart_copyInto(Cart* cart, Cart* src); // shares rom, copies ram
 bool cart_handleBattery(Cart* cart, bool save, uint8_t* data, int* size); // saves/loads ram
 uint8_t cart_read(Cart* cart, uint8_t bank, uint16_t adr);
 void cart_write(Cart* cart, uint8_t bank, uint16_t adr, uint8_t val);
+int cart_getRomOffset(Cart* cart, uint8_t bank, uint16_t adr); // -1 if not mapped to rom
 
 #endif
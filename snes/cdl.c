@@ -0,0 +1,83 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cdl.h"
+#include "statehandler.h"
+
+static const int cdlVersion = 1;
+/*
+1: initial version
+*/
+
+static void cdl_handleFile(Cdl* cdl, StateHandler* sh);
+
+Cdl* cdl_init(void) {
+  Cdl* cdl = malloc(sizeof(Cdl));
+  cdl->rom = NULL;
+  cdl_clear(cdl, 0);
+  return cdl;
+}
+
+void cdl_free(Cdl* cdl) {
+  free(cdl->rom);
+  free(cdl);
+}
+
+void cdl_clear(Cdl* cdl, int romSize) {
+  if(cdl->rom == NULL || romSize != cdl->romSize) {
+    free(cdl->rom);
+    cdl->rom = malloc(romSize > 0 ? romSize : 1);
+  }
+  cdl->romSize = romSize;
+  memset(cdl->rom, 0, romSize);
+  memset(cdl->aram, 0, sizeof(cdl->aram));
+  cdl->cpuOpcodeAdr = 0xffffffff;
+  cdl->spcOpcodeAdr = 0;
+}
+
+int cdl_save(Cdl* cdl, uint8_t* data) {
+  // returns the size, data can be NULL to only get the size
+  StateHandler sh;
+  sh_init(&sh, true, false, NULL, 0);
+  cdl_handleFile(cdl, &sh);
+  if(data == NULL) return sh.offset;
+  int size = sh.offset;
+  sh_init(&sh, true, false, data, size);
+  cdl_handleFile(cdl, &sh);
+  return size;
+}
+
+bool cdl_load(Cdl* cdl, const uint8_t* data, int size) {
+  // the flags are or-ed into the current ones, so that a log can be built up over multiple sessions
+  // returns false if the file is not valid or is for a rom of another size
+  StateHandler sh;
+  sh_init(&sh, false, false, data, size);
+  uint32_t id = 0, version = 0, romSize = 0;
+  sh_handleInts(&sh, &id, &version, &romSize, NULL);
+  if(id != 0x4443534c || version != cdlVersion || romSize != cdl->romSize || (uint64_t) 12 + romSize + 0x10000 != (uint64_t) size) {
+    return false;
+  }
+  Cdl* loaded = malloc(sizeof(Cdl));
+  loaded->rom = malloc(romSize > 0 ? romSize : 1);
+  loaded->romSize = romSize;
+  sh_init(&sh, false, false, data, size);
+  cdl_handleFile(loaded, &sh);
+  for(uint32_t i = 0; i < romSize; i++) cdl->rom[i] |= loaded->rom[i];
+  for(int i = 0; i < 0x10000; i++) cdl->aram[i] |= loaded->aram[i];
+  cdl_free(loaded);
+  return true;
+}
+
+static void cdl_handleFile(Cdl* cdl, StateHandler* sh) {
+  // header: id, version, rom size, then the rom flags and the aram flags
+  uint32_t id = 0x4443534c; // 'LSCD' LakeSnes Code/Data log
+  uint32_t version = cdlVersion;
+  uint32_t romSize = cdl->romSize;
+  sh_handleInts(sh, &id, &version, &romSize, NULL);
+  sh_handleByteArray(sh, cdl->rom, romSize);
+  sh_handleByteArray(sh, cdl->aram, 0x10000);
+}
@@ -0,0 +1,30 @@
+
+#ifndef CDL_H
+#define CDL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// flags per rom byte
+enum { cdlOpcode = 1, cdlOperand = 2, cdlData = 4, cdlDma = 8, cdlHdma = 0x10 };
+// flags per aram byte
+enum { cdlSpcOpcode = 1, cdlSpcOperand = 2, cdlSpcData = 4, cdlBrr = 8, cdlEcho = 0x10 };
+
+typedef struct Cdl {
+  // code/data log, the flags of each byte are or-ed together over all accesses since it was cleared
+  uint8_t* rom; // per byte of the rom image (without copier header, padded to a multiple of 4K)
+  uint32_t romSize;
+  uint8_t aram[0x10000];
+  // address of the opcode being executed, set by the cpu and spc
+  // reads after it and before the pc are its operands
+  uint32_t cpuOpcodeAdr;
+  uint16_t spcOpcodeAdr;
+} Cdl;
+
+Cdl* cdl_init(void);
+void cdl_free(Cdl* cdl);
+void cdl_clear(Cdl* cdl, int romSize); // also sets the rom size
+int cdl_save(Cdl* cdl, uint8_t* data);
+bool cdl_load(Cdl* cdl, const uint8_t* data, int size); // merges into the current flags
+
+#endif
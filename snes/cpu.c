@@ -15,9 +15,11 @@ static void cpu_idleWait(Cpu* cpu);
 static void cpu_checkInt(Cpu* cpu);
 static uint8_t cpu_readOpcode(Cpu* cpu);
 static uint16_t cpu_readOpcodeWord(Cpu* cpu, bool intCheck);
-static uint8_t cpu_getFlags(Cpu* cpu);
 static void cpu_setFlags(Cpu* cpu, uint8_t value);
 static void cpu_setZN(Cpu* cpu, uint16_t value, bool byte);
+static void cpu_setZNFlags(Cpu* cpu, bool z, bool n);
+static bool cpu_getZ(Cpu* cpu);
+static bool cpu_getN(Cpu* cpu);
 static void cpu_doBranch(Cpu* cpu, bool check);
 static uint8_t cpu_pullByte(Cpu* cpu);
 static void cpu_pushByte(Cpu* cpu, uint8_t value);
@@ -27,20 +29,24 @@ static uint16_t cpu_readWord(Cpu* cpu, uint32_t adrl, uint32_t adrh, bool intChe
 static void cpu_writeWord(Cpu* cpu, uint32_t adrl, uint32_t adrh, uint16_t value, bool reversed, bool intCheck);
 static void cpu_doInterrupt(Cpu* cpu);
 static void cpu_doOpcode(Cpu* cpu, uint8_t opcode);
+static void cpu_trackCall(Cpu* cpu, uint8_t opcode);
+#ifdef LAKESNES_TRACE
+static void cpu_traceOpcode(Cpu* cpu);
+#endif
 
 // addressing modes and opcode functions not declared, only used after defintions
 
-Cpu* cpu_init(void* mem, CpuReadHandler read, CpuWriteHandler write, CpuIdleHandler idle) {
-  Cpu* cpu = malloc(sizeof(Cpu));
+void cpu_init(Cpu* cpu, void* mem, CpuReadHandler read, CpuWriteHandler write, CpuIdleHandler idle) {
   cpu->mem = mem;
   cpu->read = read;
   cpu->write = write;
   cpu->idle = idle;
-  return cpu;
-}
-
-void cpu_free(Cpu* cpu) {
-  free(cpu);
+  cpu->callStack = NULL;
+  cpu->cdl = NULL;
+#ifdef LAKESNES_TRACE
+  cpu->trace = NULL;
+  cpu->traceRecord = NULL;
+#endif
 }
 
 void cpu_reset(Cpu* cpu, bool hard) {
@@ -54,9 +60,8 @@ void cpu_reset(Cpu* cpu, bool hard) {
     cpu->k = 0;
     cpu->db = 0;
     cpu->c = false;
-    cpu->z = false;
+    cpu_setZNFlags(cpu, false, false);
     cpu->v = false;
-    cpu->n = false;
     cpu->i = false;
     cpu->d = false;
     cpu->xf = false;
@@ -72,10 +77,14 @@ void cpu_reset(Cpu* cpu, bool hard) {
 }
 
 void cpu_handleState(Cpu* cpu, StateHandler* sh) {
+  // z and n are stored as bools
+  bool z = cpu_getZ(cpu);
+  bool n = cpu_getN(cpu);
   sh_handleBools(sh,
-    &cpu->c, &cpu->z, &cpu->v, &cpu->n, &cpu->i, &cpu->d, &cpu->xf, &cpu->mf, &cpu->e, &cpu->waiting, &cpu->stopped,
+    &cpu->c, &z, &cpu->v, &n, &cpu->i, &cpu->d, &cpu->xf, &cpu->mf, &cpu->e, &cpu->waiting, &cpu->stopped,
     &cpu->irqWanted, &cpu->nmiWanted, &cpu->intWanted, &cpu->resetWanted, NULL
   );
+  if(!sh->saving) cpu_setZNFlags(cpu, z, n);
   sh_handleBytes(sh, &cpu->k, &cpu->db, NULL);
   sh_handleWords(sh, &cpu->a, &cpu->x, &cpu->y, &cpu->sp, &cpu->pc, &cpu->dp, NULL);
 }
@@ -96,6 +105,7 @@ void cpu_runOpcode(Cpu* cpu) {
     cpu_setFlags(cpu, cpu_getFlags(cpu)); // updates x and m flags, clears upper half of x and y if needed
     cpu->k = 0;
     cpu->pc = cpu_readWord(cpu, 0xfffc, 0xfffd, false);
+    if(cpu->callStack != NULL) cpu->callStack->depth = 0;
     return;
   }
   if(cpu->stopped) {
@@ -118,9 +128,18 @@ void cpu_runOpcode(Cpu* cpu) {
   if(cpu->intWanted) {
     cpu_read(cpu, (cpu->k << 16) | cpu->pc);
     cpu_doInterrupt(cpu);
+    if(cpu->callStack != NULL) profiler_call(cpu->callStack, (cpu->k << 16) | cpu->pc, cpu->sp);
   } else {
+#ifdef LAKESNES_TRACE
+    if(cpu->trace != NULL) cpu_traceOpcode(cpu);
+#endif
+    if(cpu->cdl != NULL) cpu->cdl->cpuOpcodeAdr = (cpu->k << 16) | cpu->pc;
     uint8_t opcode = cpu_readOpcode(cpu);
     cpu_doOpcode(cpu, opcode);
+    if(cpu->callStack != NULL) cpu_trackCall(cpu, opcode);
+#ifdef LAKESNES_TRACE
+    cpu->traceRecord = NULL;
+#endif
   }
 }
 
@@ -153,7 +172,11 @@ static void cpu_checkInt(Cpu* cpu) {
 }
 
 static uint8_t cpu_readOpcode(Cpu* cpu) {
-  return cpu_read(cpu, (cpu->k << 16) | cpu->pc++);
+  uint8_t val = cpu_read(cpu, (cpu->k << 16) | cpu->pc++);
+#ifdef LAKESNES_TRACE
+  if(cpu->traceRecord != NULL && cpu->traceRecord->length < 4) cpu->traceRecord->bytes[cpu->traceRecord->length++] = val;
+#endif
+  return val;
 }
 
 static uint16_t cpu_readOpcodeWord(Cpu* cpu, bool intCheck) {
@@ -162,26 +185,25 @@ static uint16_t cpu_readOpcodeWord(Cpu* cpu, bool intCheck) {
   return low | (cpu_readOpcode(cpu) << 8);
 }
 
-static uint8_t cpu_getFlags(Cpu* cpu) {
-  uint8_t val = cpu->n << 7;
+uint8_t cpu_getFlags(Cpu* cpu) {
+  uint8_t val = cpu_getN(cpu) << 7;
   val |= cpu->v << 6;
   val |= cpu->mf << 5;
   val |= cpu->xf << 4;
   val |= cpu->d << 3;
   val |= cpu->i << 2;
-  val |= cpu->z << 1;
+  val |= cpu_getZ(cpu) << 1;
   val |= cpu->c;
   return val;
 }
 
 static void cpu_setFlags(Cpu* cpu, uint8_t val) {
-  cpu->n = val & 0x80;
+  cpu_setZNFlags(cpu, val & 2, val & 0x80);
   cpu->v = val & 0x40;
   cpu->mf = val & 0x20;
   cpu->xf = val & 0x10;
   cpu->d = val & 8;
   cpu->i = val & 4;
-  cpu->z = val & 2;
   cpu->c = val & 1;
   if(cpu->e) {
     cpu->mf = true;
@@ -195,13 +217,21 @@ static void cpu_setFlags(Cpu* cpu, uint8_t val) {
 }
 
 static void cpu_setZN(Cpu* cpu, uint16_t value, bool byte) {
-  if(byte) {
-    cpu->z = (value & 0xff) == 0;
-    cpu->n = value & 0x80;
-  } else {
-    cpu->z = value == 0;
-    cpu->n = value & 0x8000;
-  }
+  // bytes are moved up, so that z and n are at the same place for both sizes
+  cpu->zn = byte ? (value & 0xff) << 8 : value;
+}
+
+static void cpu_setZNFlags(Cpu* cpu, bool z, bool n) {
+  // sets z and n separately, bit 16 sets n on its own
+  cpu->zn = (n << 16) | !z;
+}
+
+static bool cpu_getZ(Cpu* cpu) {
+  return (cpu->zn & 0xffff) == 0;
+}
+
+static bool cpu_getN(Cpu* cpu) {
+  return cpu->zn & 0x18000;
 }
 
 static void cpu_doBranch(Cpu* cpu, bool check) {
@@ -273,6 +303,42 @@ static void cpu_doInterrupt(Cpu* cpu) {
   }
 }
 
+static void cpu_trackCall(Cpu* cpu, uint8_t opcode) {
+  // keeps the shadow call stack for profiling, after executing the opcode
+  switch(opcode) {
+    case 0x00: // brk
+    case 0x02: // cop
+    case 0x20: // jsr
+    case 0x22: // jsl
+    case 0xfc: // jsr (abs,x)
+      profiler_call(cpu->callStack, (cpu->k << 16) | cpu->pc, cpu->sp);
+      break;
+    case 0x40: // rti
+    case 0x60: // rts
+    case 0x6b: // rtl
+      profiler_return(cpu->callStack, cpu->sp);
+      break;
+  }
+}
+
+#ifdef LAKESNES_TRACE
+static void cpu_traceOpcode(Cpu* cpu) {
+  // starts a record for the opcode about to be fetched, cpu_readOpcode adds the bytes
+  TraceRecord* record = trace_add(cpu->trace, traceCpu);
+  record->pc = cpu->pc;
+  record->bank = cpu->k;
+  record->flags = cpu_getFlags(cpu);
+  record->db = cpu->db;
+  record->e = cpu->e;
+  record->a = cpu->a;
+  record->x = cpu->x;
+  record->y = cpu->y;
+  record->sp = cpu->sp;
+  record->dp = cpu->dp;
+  cpu->traceRecord = record;
+}
+#endif
+
 // addressing modes
 
 static void cpu_adrImp(Cpu* cpu) {
@@ -581,14 +647,12 @@ static void cpu_bit(Cpu* cpu, uint32_t low, uint32_t high) {
     cpu_checkInt(cpu);
     uint8_t value = cpu_read(cpu, low);
     uint8_t result = (cpu->a & 0xff) & value;
-    cpu->z = result == 0;
-    cpu->n = value & 0x80;
+    cpu_setZNFlags(cpu, result == 0, value & 0x80);
     cpu->v = value & 0x40;
   } else {
     uint16_t value = cpu_readWord(cpu, low, high, true);
     uint16_t result = cpu->a & value;
-    cpu->z = result == 0;
-    cpu->n = value & 0x8000;
+    cpu_setZNFlags(cpu, result == 0, value & 0x8000);
     cpu->v = value & 0x4000;
   }
 }
@@ -767,13 +831,13 @@ static void cpu_tsb(Cpu* cpu, uint32_t low, uint32_t high) {
   if(cpu->mf) {
     uint8_t value = cpu_read(cpu, low);
     cpu_idle(cpu);
-    cpu->z = ((cpu->a & 0xff) & value) == 0;
+    cpu_setZNFlags(cpu, ((cpu->a & 0xff) & value) == 0, cpu_getN(cpu));
     cpu_checkInt(cpu);
     cpu_write(cpu, low, value | (cpu->a & 0xff));
   } else {
     uint16_t value = cpu_readWord(cpu, low, high, false);
     cpu_idle(cpu);
-    cpu->z = (cpu->a & value) == 0;
+    cpu_setZNFlags(cpu, (cpu->a & value) == 0, cpu_getN(cpu));
     cpu_writeWord(cpu, low, high, value | cpu->a, true, true);
   }
 }
@@ -782,13 +846,13 @@ static void cpu_trb(Cpu* cpu, uint32_t low, uint32_t high) {
   if(cpu->mf) {
     uint8_t value = cpu_read(cpu, low);
     cpu_idle(cpu);
-    cpu->z = ((cpu->a & 0xff) & value) == 0;
+    cpu_setZNFlags(cpu, ((cpu->a & 0xff) & value) == 0, cpu_getN(cpu));
     cpu_checkInt(cpu);
     cpu_write(cpu, low, value & ~(cpu->a & 0xff));
   } else {
     uint16_t value = cpu_readWord(cpu, low, high, false);
     cpu_idle(cpu);
-    cpu->z = (cpu->a & value) == 0;
+    cpu_setZNFlags(cpu, (cpu->a & value) == 0, cpu_getN(cpu));
     cpu_writeWord(cpu, low, high, value & ~cpu->a, true, true);
   }
 }
@@ -907,7 +971,7 @@ static void cpu_doOpcode(Cpu* cpu, uint8_t opcode) {
       break;
     }
     case 0x10: { // bpl rel
-      cpu_doBranch(cpu, !cpu->n);
+      cpu_doBranch(cpu, !cpu_getN(cpu));
       break;
     }
     case 0x11: { // ora idy(r)
@@ -1113,7 +1177,7 @@ static void cpu_doOpcode(Cpu* cpu, uint8_t opcode) {
       break;
     }
     case 0x30: { // bmi rel
-      cpu_doBranch(cpu, cpu->n);
+      cpu_doBranch(cpu, cpu_getN(cpu));
       break;
     }
     case 0x31: { // and idy(r)
@@ -1710,10 +1774,10 @@ static void cpu_doOpcode(Cpu* cpu, uint8_t opcode) {
       if(cpu->mf) {
         cpu_checkInt(cpu);
         uint8_t result = (cpu->a & 0xff) & cpu_readOpcode(cpu);
-        cpu->z = result == 0;
+        cpu_setZNFlags(cpu, result == 0, cpu_getN(cpu));
       } else {
         uint16_t result = cpu->a & cpu_readOpcodeWord(cpu, true);
-        cpu->z = result == 0;
+        cpu_setZNFlags(cpu, result == 0, cpu_getN(cpu));
       }
       break;
     }
@@ -2171,7 +2235,7 @@ static void cpu_doOpcode(Cpu* cpu, uint8_t opcode) {
       break;
     }
     case 0xd0: { // bne rel
-      cpu_doBranch(cpu, !cpu->z);
+      cpu_doBranch(cpu, !cpu_getZ(cpu));
       break;
     }
     case 0xd1: { // cmp idy(r)
@@ -2373,7 +2437,7 @@ static void cpu_doOpcode(Cpu* cpu, uint8_t opcode) {
       break;
     }
     case 0xf0: { // beq rel
-      cpu_doBranch(cpu, cpu->z);
+      cpu_doBranch(cpu, cpu_getZ(cpu));
       break;
     }
     case 0xf1: { // sbc idy(r)
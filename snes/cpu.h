@@ -6,6 +6,11 @@
 #include <stdbool.h>
 
 #include "statehandler.h"
+#include "profiler.h"
+#include "cdl.h"
+#ifdef LAKESNES_TRACE
+#include "trace.h"
+#endif
 
 typedef uint8_t (*CpuReadHandler)(void* mem, uint32_t adr);
 typedef void (*CpuWriteHandler)(void* mem, uint32_t adr, uint8_t val);
@@ -29,10 +34,9 @@ struct Cpu {
   uint8_t k; // program bank (PB)
   uint8_t db; // data bank (B)
   // flags
+  uint32_t zn; // result z and n are taken from: z if bits 0-15 are 0, n if bit 15 or 16 is set
   bool c;
-  bool z;
   bool v;
-  bool n;
   bool i;
   bool d;
   bool xf;
@@ -46,14 +50,23 @@ struct Cpu {
   bool nmiWanted;
   bool intWanted;
   bool resetWanted;
+  // profiling
+  CallStack* callStack; // shadow call stack, NULL if not profiling
+  // code/data logging
+  Cdl* cdl; // gets the address of each opcode, NULL if not logging
+#ifdef LAKESNES_TRACE
+  // tracing, NULL if not tracing
+  Trace* trace;
+  TraceRecord* traceRecord; // record of the current opcode, gets the fetched bytes
+#endif
 };
 
-Cpu* cpu_init(void* mem, CpuReadHandler read, CpuWriteHandler write, CpuIdleHandler idle);
-void cpu_free(Cpu* cpu);
+void cpu_init(Cpu* cpu, void* mem, CpuReadHandler read, CpuWriteHandler write, CpuIdleHandler idle);
 void cpu_reset(Cpu* cpu, bool hard);
 void cpu_handleState(Cpu* cpu, StateHandler* sh);
 void cpu_runOpcode(Cpu* cpu);
 void cpu_nmi(Cpu* cpu);
 void cpu_setIrq(Cpu* cpu, bool state);
+uint8_t cpu_getFlags(Cpu* cpu);
 
 #endif
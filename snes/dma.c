@@ -24,20 +24,15 @@ static const int transferLength[8] = {
   1, 2, 2, 4, 4, 4, 2, 4
 };
 
-static void dma_transferByte(Dma* dma, uint16_t aAdr, uint8_t aBank, uint8_t bAdr, bool fromB);
+static void dma_transferByte(Dma* dma, uint16_t aAdr, uint8_t aBank, uint8_t bAdr, bool fromB, uint8_t cdlFlag);
+static uint8_t dma_readTable(Dma* dma, uint32_t adr);
 static void dma_waitCycle(Dma* dma);
 static void dma_doDma(Dma* dma, int cpuCycles);
 static void dma_initHdma(Dma* dma, bool doSync, int cpuCycles);
 static void dma_doHdma(Dma* dma, bool doSync, int cpuCycles);
 
-Dma* dma_init(Snes* snes) {
-  Dma* dma = malloc(sizeof(Dma));
+void dma_init(Dma* dma, Snes* snes) {
   dma->snes = snes;
-  return dma;
-}
-
-void dma_free(Dma* dma) {
-  free(dma);
 }
 
 void dma_reset(Dma* dma) {
@@ -219,7 +214,7 @@ static void dma_doDma(Dma* dma, int cpuCycles) {
       dma_waitCycle(dma);
       dma_transferByte(
         dma, dma->channel[i].aAdr, dma->channel[i].aBank,
-        dma->channel[i].bAdr + bAdrOffsets[dma->channel[i].mode][offIndex++], dma->channel[i].fromB
+        dma->channel[i].bAdr + bAdrOffsets[dma->channel[i].mode][offIndex++], dma->channel[i].fromB, cdlDma
       );
       offIndex &= 3;
       if(!dma->channel[i].fixed) {
@@ -255,13 +250,13 @@ static void dma_initHdma(Dma* dma, bool doSync, int cpuCycles) {
       // load address, repCount, and indirect address if needed
       snes_runCycles(dma->snes, 8);
       dma->channel[i].tableAdr = dma->channel[i].aAdr;
-      dma->channel[i].repCount = snes_read(dma->snes, (dma->channel[i].aBank << 16) | dma->channel[i].tableAdr++);
+      dma->channel[i].repCount = dma_readTable(dma, (dma->channel[i].aBank << 16) | dma->channel[i].tableAdr++);
       if(dma->channel[i].repCount == 0) dma->channel[i].terminated = true;
       if(dma->channel[i].indirect) {
         snes_runCycles(dma->snes, 8);
-        dma->channel[i].size = snes_read(dma->snes, (dma->channel[i].aBank << 16) | dma->channel[i].tableAdr++);
+        dma->channel[i].size = dma_readTable(dma, (dma->channel[i].aBank << 16) | dma->channel[i].tableAdr++);
         snes_runCycles(dma->snes, 8);
-        dma->channel[i].size |= snes_read(dma->snes, (dma->channel[i].aBank << 16) | dma->channel[i].tableAdr++) << 8;
+        dma->channel[i].size |= dma_readTable(dma, (dma->channel[i].aBank << 16) | dma->channel[i].tableAdr++) << 8;
       }
       dma->channel[i].doTransfer = true;
     }
@@ -295,12 +290,12 @@ static void dma_doHdma(Dma* dma, bool doSync, int cpuCycles) {
           if(dma->channel[i].indirect) {
             dma_transferByte(
               dma, dma->channel[i].size++, dma->channel[i].indBank,
-              dma->channel[i].bAdr + bAdrOffsets[dma->channel[i].mode][j], dma->channel[i].fromB
+              dma->channel[i].bAdr + bAdrOffsets[dma->channel[i].mode][j], dma->channel[i].fromB, cdlHdma
             );
           } else {
             dma_transferByte(
               dma, dma->channel[i].tableAdr++, dma->channel[i].aBank,
-              dma->channel[i].bAdr + bAdrOffsets[dma->channel[i].mode][j], dma->channel[i].fromB
+              dma->channel[i].bAdr + bAdrOffsets[dma->channel[i].mode][j], dma->channel[i].fromB, cdlHdma
             );
           }
         }
@@ -313,7 +308,7 @@ static void dma_doHdma(Dma* dma, bool doSync, int cpuCycles) {
       dma->channel[i].repCount--;
       dma->channel[i].doTransfer = dma->channel[i].repCount & 0x80;
       snes_runCycles(dma->snes, 8);
-      uint8_t newRepCount = snes_read(dma->snes, (dma->channel[i].aBank << 16) | dma->channel[i].tableAdr);
+      uint8_t newRepCount = dma_readTable(dma, (dma->channel[i].aBank << 16) | dma->channel[i].tableAdr);
       if((dma->channel[i].repCount & 0x7f) == 0) {
         dma->channel[i].repCount = newRepCount;
         dma->channel[i].tableAdr++;
@@ -323,10 +318,10 @@ static void dma_doHdma(Dma* dma, bool doSync, int cpuCycles) {
             dma->channel[i].size = 0;
           } else {
             snes_runCycles(dma->snes, 8);
-            dma->channel[i].size = snes_read(dma->snes, (dma->channel[i].aBank << 16) | dma->channel[i].tableAdr++);
+            dma->channel[i].size = dma_readTable(dma, (dma->channel[i].aBank << 16) | dma->channel[i].tableAdr++);
           }
           snes_runCycles(dma->snes, 8);
-          dma->channel[i].size |= snes_read(dma->snes, (dma->channel[i].aBank << 16) | dma->channel[i].tableAdr++) << 8;
+          dma->channel[i].size |= dma_readTable(dma, (dma->channel[i].aBank << 16) | dma->channel[i].tableAdr++) << 8;
         }
         if(dma->channel[i].repCount == 0) dma->channel[i].terminated = true;
         dma->channel[i].doTransfer = true;
@@ -336,7 +331,7 @@ static void dma_doHdma(Dma* dma, bool doSync, int cpuCycles) {
   if(doSync) snes_syncCycles(dma->snes, false, cpuCycles);
 }
 
-static void dma_transferByte(Dma* dma, uint16_t aAdr, uint8_t aBank, uint8_t bAdr, bool fromB) {
+static void dma_transferByte(Dma* dma, uint16_t aAdr, uint8_t aBank, uint8_t bAdr, bool fromB, uint8_t cdlFlag) {
   // accessing 0x2180 via b-bus while a-bus accesses ram gives open bus
   bool validB = !(bAdr == 0x80 && (aBank == 0x7e || aBank == 0x7f || (
     (aBank < 0x40 || (aBank >= 0x80 && aBank < 0xc0)) && aAdr < 0x2000
@@ -350,10 +345,17 @@ static void dma_transferByte(Dma* dma, uint16_t aAdr, uint8_t aBank, uint8_t bAd
     if(validA) snes_write(dma->snes, (aBank << 16) | aAdr, val);
   } else {
     uint8_t val = validA ? snes_read(dma->snes, (aBank << 16) | aAdr) : dma->snes->openBus;
+    if(validA && dma->snes->cdl != NULL) snes_logRead(dma->snes, (aBank << 16) | aAdr, cdlFlag);
     if(validB) snes_writeBBus(dma->snes, bAdr, val);
   }
 }
 
+static uint8_t dma_readTable(Dma* dma, uint32_t adr) {
+  // reads from a hdma table
+  if(dma->snes->cdl != NULL) snes_logRead(dma->snes, adr, cdlHdma);
+  return snes_read(dma->snes, adr);
+}
+
 void dma_handleDma(Dma* dma, int cpuCycles) {
   // if hdma triggered, do it, except if dmastate indicates dma will be done now
   // (it will be done as part of the dma in that case)
@@ -39,8 +39,7 @@ struct Dma {
   bool hdmaRunRequested;
 };
 
-Dma* dma_init(Snes* snes);
-void dma_free(Dma* dma);
+void dma_init(Dma* dma, Snes* snes);
 void dma_reset(Dma* dma);
 void dma_handleState(Dma* dma, StateHandler* sh);
 uint8_t dma_read(Dma* dma, uint16_t adr); // 43x0-43xf
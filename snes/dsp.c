@@ -66,14 +66,8 @@ static void dsp_decodeBrr(Dsp* dsp, int ch);
 static int16_t dsp_getSample(Dsp* dsp, int ch);
 static void dsp_handleNoise(Dsp* dsp);
 
-Dsp* dsp_init(Apu* apu) {
-  Dsp* dsp = malloc(sizeof(Dsp));
+void dsp_init(Dsp* dsp, Apu* apu) {
   dsp->apu = apu;
-  return dsp;
-}
-
-void dsp_free(Dsp* dsp) {
-  free(dsp);
 }
 
 void dsp_reset(Dsp* dsp) {
@@ -227,6 +221,9 @@ static void dsp_handleEcho(Dsp* dsp) {
   dsp->firBufferL[dsp->firBufferIndex] = ramSample >> 1;
   ramSample = dsp->apu->ram[(adr + 2) & 0xffff] | (dsp->apu->ram[(adr + 3) & 0xffff] << 8);
   dsp->firBufferR[dsp->firBufferIndex] = ramSample >> 1;
+  if(dsp->apu->snes->cdl != NULL) {
+    for(int i = 0; i < 4; i++) dsp->apu->snes->cdl->aram[(adr + i) & 0xffff] |= cdlEcho;
+  }
   // calculate FIR-sum
   int sumL = 0, sumR = 0;
   for(int i = 0; i < 8; i++) {
@@ -252,6 +249,8 @@ static void dsp_handleEcho(Dsp* dsp) {
     dsp->apu->ram[(adr + 1) & 0xffff] = echoL >> 8;
     dsp->apu->ram[(adr + 2) & 0xffff] = echoR & 0xff;
     dsp->apu->ram[(adr + 3) & 0xffff] = echoR >> 8;
+    dsp->apu->ramDirty[adr >> 8] = true;
+    dsp->apu->ramDirty[((adr + 3) & 0xffff) >> 8] = true;
   }
   // handle indexes
   if(dsp->echoBufferIndex == 0) {
@@ -425,7 +424,12 @@ static void dsp_decodeBrr(Dsp* dsp, int ch) {
     if(i & 1) {
       s = curByte & 0xf;
     } else {
-      curByte = dsp->apu->ram[(dsp->channel[ch].decodeOffset + dsp->channel[ch].blockOffset + (i >> 1)) & 0xffff];
+      uint16_t adr = dsp->channel[ch].decodeOffset + dsp->channel[ch].blockOffset + (i >> 1);
+      curByte = dsp->apu->ram[adr];
+      if(dsp->apu->snes->cdl != NULL) {
+        dsp->apu->snes->cdl->aram[adr] |= cdlBrr;
+        dsp->apu->snes->cdl->aram[dsp->channel[ch].decodeOffset] |= cdlBrr; // header
+      }
       s = curByte >> 4;
     }
     if(s > 7) s -= 16;
@@ -581,6 +585,19 @@ void dsp_write(Dsp* dsp, uint8_t adr, uint8_t val) {
   dsp->ram[adr] = val;
 }
 
+int dsp_getNewSamples(Dsp* dsp, int16_t* sampleData, uint16_t* position) {
+  // copies the samples produced since position (at most 0x400, older ones are lost), and updates it
+  int count = (uint16_t) (dsp->sampleOffset - *position);
+  if(count > 0x400) count = 0x400;
+  for(int i = 0; i < count; i++) {
+    int index = (dsp->sampleOffset - count + i) & 0x3ff;
+    sampleData[i * 2] = dsp->sampleBuffer[index * 2];
+    sampleData[i * 2 + 1] = dsp->sampleBuffer[index * 2 + 1];
+  }
+  *position = dsp->sampleOffset;
+  return count;
+}
+
 void dsp_getSamples(Dsp* dsp, int16_t* sampleData, int samplesPerFrame) {
   // resample from 534 / 641 samples per frame to wanted value
   float wantedSamples = (dsp->apu->snes->palTiming ? 641.0 : 534.0);
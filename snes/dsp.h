@@ -85,13 +85,13 @@ struct Dsp {
   uint16_t sampleOffset; // current offset in samplebuffer
 };
 
-Dsp* dsp_init(Apu* apu);
-void dsp_free(Dsp* dsp);
+void dsp_init(Dsp* dsp, Apu* apu);
 void dsp_reset(Dsp* dsp);
 void dsp_handleState(Dsp* dsp, StateHandler* sh);
 void dsp_cycle(Dsp* dsp);
 uint8_t dsp_read(Dsp* dsp, uint8_t adr);
 void dsp_write(Dsp* dsp, uint8_t adr, uint8_t val);
 void dsp_getSamples(Dsp* dsp, int16_t* sampleData, int samplesPerFrame);
+int dsp_getNewSamples(Dsp* dsp, int16_t* sampleData, uint16_t* position);
 
 #endif
@@ -9,18 +9,12 @@
 #include "snes.h"
 #include "statehandler.h"
 
-Input* input_init(Snes* snes) {
-  Input* input = malloc(sizeof(Input));
+void input_init(Input* input, Snes* snes) {
   input->snes = snes;
   // TODO: handle (where?)
   input->type = 1;
   input->currentState = 0;
   // TODO: handle I/O line (and latching of PPU)
-  return input;
-}
-
-void input_free(Input* input) {
-  free(input);
 }
 
 void input_reset(Input* input) {
@@ -20,8 +20,7 @@ struct Input {
   uint16_t latchedState;
 };
 
-Input* input_init(Snes* snes);
-void input_free(Input* input);
+void input_init(Input* input, Snes* snes);
 void input_reset(Input* input);
 void input_handleState(Input* input, StateHandler* sh);
 void input_latch(Input* input, bool value);
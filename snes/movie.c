@@ -0,0 +1,181 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "movie.h"
+#include "snes.h"
+#include "input.h"
+#include "statehandler.h"
+
+static const int movieVersion = 1;
+/*
+1: initial version
+*/
+
+static void movie_powerOn(Movie* movie);
+static void movie_handleFile(Movie* movie, StateHandler* sh);
+
+Movie* movie_init(Snes* snes) {
+  Movie* movie = malloc(sizeof(Movie));
+  movie->snes = snes;
+  movie->recording = false;
+  movie->playing = false;
+  movie->capacity = 60 * 60;
+  movie->inputs = malloc(movie->capacity * 2 * sizeof(uint16_t));
+  movie->frameCount = 0;
+  movie->position = 0;
+  movie->anchorState = NULL;
+  movie->anchorSize = 0;
+  movie->battery = NULL;
+  movie->batterySize = 0;
+  return movie;
+}
+
+void movie_free(Movie* movie) {
+  movie_stop(movie);
+  free(movie->inputs);
+  free(movie->anchorState);
+  free(movie);
+}
+
+void movie_startRecording(Movie* movie, bool fromState) {
+  // starts a new recording, either from the current state or from power-on (hard reset with cleared battery ram)
+  movie_stop(movie);
+  free(movie->anchorState);
+  movie->anchorState = NULL;
+  movie->anchorSize = 0;
+  if(fromState) {
+    movie->anchorSize = snes_saveState(movie->snes, NULL);
+    movie->anchorState = malloc(movie->anchorSize);
+    snes_saveState(movie->snes, movie->anchorState);
+  } else {
+    movie_powerOn(movie);
+  }
+  movie->frameCount = 0;
+  movie->position = 0;
+  movie->recording = true;
+  movie->snes->movie = movie;
+}
+
+bool movie_startPlayback(Movie* movie) {
+  // goes back to the start of the movie and plays it, returns false if the anchor state can't be loaded
+  movie_stop(movie);
+  if(movie->anchorState != NULL) {
+    if(!snes_loadState(movie->snes, movie->anchorState, movie->anchorSize)) return false;
+  } else {
+    movie_powerOn(movie);
+  }
+  movie->position = 0;
+  movie->playing = true;
+  movie->snes->movie = movie;
+  return true;
+}
+
+void movie_stop(Movie* movie) {
+  // if it started from power-on, this puts back the battery ram from before it started
+  if(movie->snes->movie == movie) movie->snes->movie = NULL;
+  movie->recording = false;
+  movie->playing = false;
+  if(movie->battery != NULL) {
+    snes_loadBattery(movie->snes, movie->battery, movie->batterySize);
+    free(movie->battery);
+    movie->battery = NULL;
+    movie->batterySize = 0;
+  }
+}
+
+void movie_handleFrame(Movie* movie) {
+  // called once per frame at the start of vblank, just before the auto-joypad read
+  Input* input1 = movie->snes->input1;
+  Input* input2 = movie->snes->input2;
+  if(movie->recording) {
+    if(movie->frameCount == movie->capacity) {
+      movie->capacity *= 2;
+      movie->inputs = realloc(movie->inputs, movie->capacity * 2 * sizeof(uint16_t));
+    }
+    movie->inputs[movie->frameCount * 2] = input1->currentState;
+    movie->inputs[movie->frameCount * 2 + 1] = input2->currentState;
+    movie->frameCount++;
+    movie->position++;
+  } else if(movie->playing) {
+    if(movie->position == movie->frameCount) {
+      // done, leave the last input state as is
+      movie_stop(movie);
+      return;
+    }
+    input1->currentState = movie->inputs[movie->position * 2];
+    input2->currentState = movie->inputs[movie->position * 2 + 1];
+    movie->position++;
+  }
+}
+
+int movie_save(Movie* movie, uint8_t* data) {
+  // returns the size, data can be NULL to only get the size
+  StateHandler sh;
+  sh_init(&sh, true, false, NULL, 0);
+  movie_handleFile(movie, &sh);
+  if(data == NULL) return sh.offset;
+  int size = sh.offset;
+  sh_init(&sh, true, false, data, size);
+  movie_handleFile(movie, &sh);
+  return size;
+}
+
+bool movie_load(Movie* movie, const uint8_t* data, int size) {
+  // stops the current recording or playback, playback can be started after loading
+  movie_stop(movie);
+  StateHandler sh;
+  sh_init(&sh, false, false, data, size);
+  uint32_t id = 0, version = 0, frameCount = 0, anchorSize = 0;
+  sh_handleInts(&sh, &id, &version, &frameCount, &anchorSize, NULL);
+  if(id != 0x564d534c || version != movieVersion || (uint64_t) 16 + anchorSize + frameCount * 4ull != (uint64_t) size) {
+    return false;
+  }
+  free(movie->anchorState);
+  movie->anchorState = NULL;
+  movie->anchorSize = anchorSize;
+  if(anchorSize > 0) {
+    movie->anchorState = malloc(anchorSize);
+    sh_handleByteArray(&sh, movie->anchorState, anchorSize);
+  }
+  if(frameCount > movie->capacity) {
+    movie->capacity = frameCount;
+    movie->inputs = realloc(movie->inputs, movie->capacity * 2 * sizeof(uint16_t));
+  }
+  movie->frameCount = frameCount;
+  movie->position = 0;
+  sh_handleWordArray(&sh, movie->inputs, frameCount * 2);
+  return true;
+}
+
+static void movie_powerOn(Movie* movie) {
+  // hard reset with no buttons held, with battery ram cleared so that it does not depend on previous runs
+  // the battery ram is kept, to be put back by movie_stop
+  movie->snes->input1->currentState = 0;
+  movie->snes->input2->currentState = 0;
+  int size = snes_saveBattery(movie->snes, NULL);
+  if(size > 0) {
+    movie->battery = malloc(size);
+    movie->batterySize = size;
+    snes_saveBattery(movie->snes, movie->battery);
+    uint8_t* battery = calloc(size, 1);
+    snes_loadBattery(movie->snes, battery, size);
+    free(battery);
+  }
+  snes_reset(movie->snes, true);
+}
+
+static void movie_handleFile(Movie* movie, StateHandler* sh) {
+  // header: id, version, frame count, anchor state size (0 for power-on)
+  // then the anchor state, then 2 words (controller 1 and 2) per frame
+  uint32_t id = 0x564d534c; // 'LSMV' LakeSnes MoVie
+  uint32_t version = movieVersion;
+  uint32_t frameCount = movie->frameCount;
+  uint32_t anchorSize = movie->anchorSize;
+  sh_handleInts(sh, &id, &version, &frameCount, &anchorSize, NULL);
+  if(anchorSize > 0) sh_handleByteArray(sh, movie->anchorState, anchorSize);
+  sh_handleWordArray(sh, movie->inputs, frameCount * 2);
+}
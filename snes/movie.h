@@ -0,0 +1,38 @@
+
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct Movie Movie;
+
+#include "snes.h"
+
+struct Movie {
+  Snes* snes;
+  bool recording;
+  bool playing;
+  // controller states, 2 per frame (controller 1 and 2)
+  uint16_t* inputs;
+  int frameCount;
+  int capacity;
+  int position; // next frame to record or play
+  // state it starts from, NULL if it starts from power-on
+  uint8_t* anchorState;
+  int anchorSize;
+  // battery ram from before a power-on start, put back when stopping, NULL if none
+  uint8_t* battery;
+  int batterySize;
+};
+
+Movie* movie_init(Snes* snes);
+void movie_free(Movie* movie);
+void movie_startRecording(Movie* movie, bool fromState);
+bool movie_startPlayback(Movie* movie);
+void movie_stop(Movie* movie);
+void movie_handleFrame(Movie* movie);
+int movie_save(Movie* movie, uint8_t* data);
+bool movie_load(Movie* movie, const uint8_t* data, int size);
+
+#endif
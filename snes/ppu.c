@@ -71,20 +71,21 @@ static int ppu_getPixelForMode7(Ppu* ppu, int x, int layer, bool priority);
 static bool ppu_getWindowState(Ppu* ppu, int layer, int x);
 static void ppu_evaluateSprites(Ppu* ppu, int line);
 static uint16_t ppu_getVramRemap(Ppu* ppu);
+static void ppu_outputLine(Ppu* ppu, int line, bool hires);
+static void ppu_widenOutput(Ppu* ppu, int rows);
+static int ppu_getOutputBytesPerPixel(Ppu* ppu);
 
-Ppu* ppu_init(Snes* snes) {
-  Ppu* ppu = malloc(sizeof(Ppu));
+void ppu_init(Ppu* ppu, Snes* snes, uint16_t* vram) {
+  // vram is 64K
   ppu->snes = snes;
+  ppu->vram = vram;
+  ppu_setPixelOutput(ppu, NULL, 0, false);
   ppu_setPixelOutputFormat(ppu, ppu_pixelOutputFormatBGRX);
-  return ppu;
-}
-
-void ppu_free(Ppu* ppu) {
-  free(ppu);
+  ppu->renderSkip = false;
 }
 
 void ppu_reset(Ppu* ppu) {
-  memset(ppu->vram, 0, sizeof(ppu->vram));
+  memset(ppu->vram, 0, 0x10000);
   ppu->vramPointer = 0;
   ppu->vramIncrementOnHigh = false;
   ppu->vramIncrement = 1;
@@ -112,65 +113,65 @@ void ppu_reset(Ppu* ppu) {
   ppu->rangeOver = false;
   ppu->objInterlace = false;
   for(int i = 0; i < 4; i++) {
-    ppu->bgLayer[i].hScroll = 0;
-    ppu->bgLayer[i].vScroll = 0;
-    ppu->bgLayer[i].tilemapWider = false;
-    ppu->bgLayer[i].tilemapHigher = false;
-    ppu->bgLayer[i].tilemapAdr = 0;
-    ppu->bgLayer[i].tileAdr = 0;
-    ppu->bgLayer[i].bigTiles = false;
-    ppu->bgLayer[i].mosaicEnabled = false;
+    ppu->lineState.bgLayer[i].hScroll = 0;
+    ppu->lineState.bgLayer[i].vScroll = 0;
+    ppu->lineState.bgLayer[i].tilemapWider = false;
+    ppu->lineState.bgLayer[i].tilemapHigher = false;
+    ppu->lineState.bgLayer[i].tilemapAdr = 0;
+    ppu->lineState.bgLayer[i].tileAdr = 0;
+    ppu->lineState.bgLayer[i].bigTiles = false;
+    ppu->lineState.bgLayer[i].mosaicEnabled = false;
   }
   ppu->scrollPrev = 0;
   ppu->scrollPrev2 = 0;
-  ppu->mosaicSize = 1;
-  ppu->mosaicStartLine = 1;
+  ppu->lineState.mosaicSize = 1;
+  ppu->lineState.mosaicStartLine = 1;
   for(int i = 0; i < 5; i++) {
-    ppu->layer[i].mainScreenEnabled = false;
-    ppu->layer[i].subScreenEnabled = false;
-    ppu->layer[i].mainScreenWindowed = false;
-    ppu->layer[i].subScreenWindowed = false;
+    ppu->lineState.layer[i].mainScreenEnabled = false;
+    ppu->lineState.layer[i].subScreenEnabled = false;
+    ppu->lineState.layer[i].mainScreenWindowed = false;
+    ppu->lineState.layer[i].subScreenWindowed = false;
   }
-  memset(ppu->m7matrix, 0, sizeof(ppu->m7matrix));
+  memset(ppu->lineState.m7matrix, 0, sizeof(ppu->lineState.m7matrix));
   ppu->m7prev = 0;
-  ppu->m7largeField = false;
-  ppu->m7charFill = false;
-  ppu->m7xFlip = false;
-  ppu->m7yFlip = false;
-  ppu->m7extBg = false;
+  ppu->lineState.m7largeField = false;
+  ppu->lineState.m7charFill = false;
+  ppu->lineState.m7xFlip = false;
+  ppu->lineState.m7yFlip = false;
+  ppu->lineState.m7extBg = false;
   ppu->m7startX = 0;
   ppu->m7startY = 0;
   for(int i = 0; i < 6; i++) {
-    ppu->windowLayer[i].window1enabled = false;
-    ppu->windowLayer[i].window2enabled = false;
-    ppu->windowLayer[i].window1inversed = false;
-    ppu->windowLayer[i].window2inversed = false;
-    ppu->windowLayer[i].maskLogic = 0;
+    ppu->lineState.windowLayer[i].window1enabled = false;
+    ppu->lineState.windowLayer[i].window2enabled = false;
+    ppu->lineState.windowLayer[i].window1inversed = false;
+    ppu->lineState.windowLayer[i].window2inversed = false;
+    ppu->lineState.windowLayer[i].maskLogic = 0;
   }
-  ppu->window1left = 0;
-  ppu->window1right = 0;
-  ppu->window2left = 0;
-  ppu->window2right = 0;
-  ppu->clipMode = 0;
-  ppu->preventMathMode = 0;
-  ppu->addSubscreen = false;
-  ppu->subtractColor = false;
-  ppu->halfColor = false;
-  memset(ppu->mathEnabled, 0, sizeof(ppu->mathEnabled));
-  ppu->fixedColorR = 0;
-  ppu->fixedColorG = 0;
-  ppu->fixedColorB = 0;
-  ppu->forcedBlank = true;
-  ppu->brightness = 0;
-  ppu->mode = 0;
-  ppu->bg3priority = false;
+  ppu->lineState.window1left = 0;
+  ppu->lineState.window1right = 0;
+  ppu->lineState.window2left = 0;
+  ppu->lineState.window2right = 0;
+  ppu->lineState.clipMode = 0;
+  ppu->lineState.preventMathMode = 0;
+  ppu->lineState.addSubscreen = false;
+  ppu->lineState.subtractColor = false;
+  ppu->lineState.halfColor = false;
+  memset(ppu->lineState.mathEnabled, 0, sizeof(ppu->lineState.mathEnabled));
+  ppu->lineState.fixedColorR = 0;
+  ppu->lineState.fixedColorG = 0;
+  ppu->lineState.fixedColorB = 0;
+  ppu->lineState.forcedBlank = true;
+  ppu->lineState.brightness = 0;
+  ppu->lineState.mode = 0;
+  ppu->lineState.bg3priority = false;
   ppu->evenFrame = false;
-  ppu->pseudoHires = false;
+  ppu->lineState.pseudoHires = false;
   ppu->overscan = false;
   ppu->frameOverscan = false;
   ppu->interlace = false;
   ppu->frameInterlace = false;
-  ppu->directColor = false;
+  ppu->lineState.directColor = false;
   ppu->hCount = 0;
   ppu->vCount = 0;
   ppu->hCountSecond = false;
@@ -178,24 +179,28 @@ void ppu_reset(Ppu* ppu) {
   ppu->countersLatched = false;
   ppu->ppu1openBus = 0;
   ppu->ppu2openBus = 0;
-  memset(ppu->pixelBuffer, 0, sizeof(ppu->pixelBuffer));
+  memset(ppu->lineBuffer, 0, sizeof(ppu->lineBuffer));
+  ppu->outputWide = !ppu->pixelOutputNarrow;
+  ppu->outputInterlace = false;
+  ppu->outputOverscan = false;
+  ppu->outputBothFields = false;
 }
 
 void ppu_handleState(Ppu* ppu, StateHandler* sh) {
   sh_handleBools(sh,
     &ppu->vramIncrementOnHigh, &ppu->cgramSecondWrite, &ppu->oamInHigh, &ppu->oamInHighWritten, &ppu->oamSecondWrite,
-    &ppu->objPriority, &ppu->timeOver, &ppu->rangeOver, &ppu->objInterlace, &ppu->m7largeField, &ppu->m7charFill,
-    &ppu->m7xFlip, &ppu->m7yFlip, &ppu->m7extBg, &ppu->addSubscreen, &ppu->subtractColor, &ppu->halfColor,
-    &ppu->mathEnabled[0], &ppu->mathEnabled[1], &ppu->mathEnabled[2], &ppu->mathEnabled[3], &ppu->mathEnabled[4],
-    &ppu->mathEnabled[5], &ppu->forcedBlank, &ppu->bg3priority, &ppu->evenFrame, &ppu->pseudoHires, &ppu->overscan,
-    &ppu->frameOverscan, &ppu->interlace, &ppu->frameInterlace, &ppu->directColor, &ppu->hCountSecond, &ppu->vCountSecond,
+    &ppu->objPriority, &ppu->timeOver, &ppu->rangeOver, &ppu->objInterlace, &ppu->lineState.m7largeField, &ppu->lineState.m7charFill,
+    &ppu->lineState.m7xFlip, &ppu->lineState.m7yFlip, &ppu->lineState.m7extBg, &ppu->lineState.addSubscreen, &ppu->lineState.subtractColor, &ppu->lineState.halfColor,
+    &ppu->lineState.mathEnabled[0], &ppu->lineState.mathEnabled[1], &ppu->lineState.mathEnabled[2], &ppu->lineState.mathEnabled[3], &ppu->lineState.mathEnabled[4],
+    &ppu->lineState.mathEnabled[5], &ppu->lineState.forcedBlank, &ppu->lineState.bg3priority, &ppu->evenFrame, &ppu->lineState.pseudoHires, &ppu->overscan,
+    &ppu->frameOverscan, &ppu->interlace, &ppu->frameInterlace, &ppu->lineState.directColor, &ppu->hCountSecond, &ppu->vCountSecond,
     &ppu->countersLatched, NULL
   );
   sh_handleBytes(sh,
     &ppu->vramRemapMode, &ppu->cgramPointer, &ppu->cgramBuffer, &ppu->oamAdr, &ppu->oamAdrWritten, &ppu->oamBuffer,
-    &ppu->objSize, &ppu->scrollPrev, &ppu->scrollPrev2, &ppu->mosaicSize, &ppu->mosaicStartLine, &ppu->m7prev,
-    &ppu->window1left, &ppu->window1right, &ppu->window2left, &ppu->window2right, &ppu->clipMode, &ppu->preventMathMode,
-    &ppu->fixedColorR, &ppu->fixedColorG, &ppu->fixedColorB, &ppu->brightness, &ppu->mode,
+    &ppu->objSize, &ppu->scrollPrev, &ppu->scrollPrev2, &ppu->lineState.mosaicSize, &ppu->lineState.mosaicStartLine, &ppu->m7prev,
+    &ppu->lineState.window1left, &ppu->lineState.window1right, &ppu->lineState.window2left, &ppu->lineState.window2right, &ppu->lineState.clipMode, &ppu->lineState.preventMathMode,
+    &ppu->lineState.fixedColorR, &ppu->lineState.fixedColorG, &ppu->lineState.fixedColorB, &ppu->lineState.brightness, &ppu->lineState.mode,
     &ppu->ppu1openBus, &ppu->ppu2openBus, NULL
   );
   sh_handleWords(sh,
@@ -203,36 +208,36 @@ void ppu_handleState(Ppu* ppu, StateHandler* sh) {
     &ppu->hCount, &ppu->vCount, NULL
   );
   sh_handleWordsS(sh,
-    &ppu->m7matrix[0], &ppu->m7matrix[1], &ppu->m7matrix[2], &ppu->m7matrix[3], &ppu->m7matrix[4], &ppu->m7matrix[5],
-    &ppu->m7matrix[6], &ppu->m7matrix[7], NULL
+    &ppu->lineState.m7matrix[0], &ppu->lineState.m7matrix[1], &ppu->lineState.m7matrix[2], &ppu->lineState.m7matrix[3], &ppu->lineState.m7matrix[4], &ppu->lineState.m7matrix[5],
+    &ppu->lineState.m7matrix[6], &ppu->lineState.m7matrix[7], NULL
   );
   sh_handleIntsS(sh, &ppu->m7startX, &ppu->m7startY, NULL);
   for(int i = 0; i < 4; i++) {
     sh_handleBools(sh,
-      &ppu->bgLayer[i].tilemapWider, &ppu->bgLayer[i].tilemapHigher, &ppu->bgLayer[i].bigTiles,
-      &ppu->bgLayer[i].mosaicEnabled, NULL
+      &ppu->lineState.bgLayer[i].tilemapWider, &ppu->lineState.bgLayer[i].tilemapHigher, &ppu->lineState.bgLayer[i].bigTiles,
+      &ppu->lineState.bgLayer[i].mosaicEnabled, NULL
     );
     sh_handleWords(sh,
-      &ppu->bgLayer[i].hScroll, &ppu->bgLayer[i].vScroll, &ppu->bgLayer[i].tilemapAdr, &ppu->bgLayer[i].tileAdr, NULL
+      &ppu->lineState.bgLayer[i].hScroll, &ppu->lineState.bgLayer[i].vScroll, &ppu->lineState.bgLayer[i].tilemapAdr, &ppu->lineState.bgLayer[i].tileAdr, NULL
     );
   }
   for(int i = 0; i < 5; i++) {
     sh_handleBools(sh,
-      &ppu->layer[i].mainScreenEnabled, &ppu->layer[i].subScreenEnabled, &ppu->layer[i].mainScreenWindowed,
-      &ppu->layer[i].subScreenWindowed, NULL
+      &ppu->lineState.layer[i].mainScreenEnabled, &ppu->lineState.layer[i].subScreenEnabled, &ppu->lineState.layer[i].mainScreenWindowed,
+      &ppu->lineState.layer[i].subScreenWindowed, NULL
     );
   }
   for(int i = 0; i < 6; i++) {
     sh_handleBools(sh,
-      &ppu->windowLayer[i].window1enabled, &ppu->windowLayer[i].window1inversed, &ppu->windowLayer[i].window2enabled,
-      &ppu->windowLayer[i].window2inversed, NULL
+      &ppu->lineState.windowLayer[i].window1enabled, &ppu->lineState.windowLayer[i].window1inversed, &ppu->lineState.windowLayer[i].window2enabled,
+      &ppu->lineState.windowLayer[i].window2inversed, NULL
     );
-    sh_handleBytes(sh, &ppu->windowLayer[i].maskLogic, NULL);
+    sh_handleBytes(sh, &ppu->lineState.windowLayer[i].maskLogic, NULL);
   }
-  sh_handleWordArray(sh, ppu->vram, 0x8000);
-  sh_handleWordArray(sh, ppu->cgram, 0x100);
-  sh_handleWordArray(sh, ppu->oam, 0x100);
-  sh_handleByteArray(sh, ppu->highOam, 0x20);
+  sh_handleDirtyWordArray(sh, ppu->vram, 0x8000, ppu->vramDirty);
+  sh_handleDirtyWordArray(sh, ppu->cgram, 0x100, ppu->cgramDirty);
+  sh_handleDirtyWordArray(sh, ppu->oam, 0x100, ppu->oamDirty);
+  sh_handleDirtyByteArray(sh, ppu->highOam, 0x20, ppu->highOamDirty);
   sh_handleByteArray(sh, ppu->objPixelBuffer, 256);
   sh_handleByteArray(sh, ppu->objPriorityBuffer, 256);
 }
@@ -240,12 +245,13 @@ void ppu_handleState(Ppu* ppu, StateHandler* sh) {
 bool ppu_checkOverscan(Ppu* ppu) {
   // called at (0,225)
   ppu->frameOverscan = ppu->overscan; // set if we have a overscan-frame
+  if(!ppu->renderSkip) ppu->outputOverscan = ppu->frameOverscan;
   return ppu->frameOverscan;
 }
 
 void ppu_handleVblank(Ppu* ppu) {
   // called either right after ppu_checkOverscan at (0,225), or at (0,240)
-  if(!ppu->forcedBlank) {
+  if(!ppu->lineState.forcedBlank) {
     ppu->oamAdr = ppu->oamAdrWritten;
     ppu->oamInHigh = ppu->oamInHighWritten;
     ppu->oamSecondWrite = false;
@@ -255,66 +261,184 @@ void ppu_handleVblank(Ppu* ppu) {
 
 void ppu_handleFrameStart(Ppu* ppu) {
   // called at (0, 0)
-  ppu->mosaicStartLine = 1;
+  ppu->lineState.mosaicStartLine = 1;
   ppu->rangeOver = false;
   ppu->timeOver = false;
   ppu->evenFrame = !ppu->evenFrame;
+  if(ppu->renderSkip) return; // pixel output keeps the last rendered frame
+  // after changing the output, report all lines as changed for the first frame
+  memset(ppu->outputLineChanged, ppu->outputInvalid, sizeof(ppu->outputLineChanged));
+  ppu->outputInvalid = false;
+  ppu->outputBothFields = ppu->interlace && !ppu->outputInterlace;
+  ppu->outputInterlace = ppu->interlace;
+  ppu->outputWide = !ppu->pixelOutputNarrow || ppu->outputInterlace; // interlaced frames are always output wide
 }
 
 void ppu_runLine(Ppu* ppu, int line) {
   // called for lines 1-224/239
   // evaluate sprites
   memset(ppu->objPixelBuffer, 0, sizeof(ppu->objPixelBuffer));
-  if(!ppu->forcedBlank) ppu_evaluateSprites(ppu, line - 1);
+  if(!ppu->lineState.forcedBlank) ppu_evaluateSprites(ppu, line - 1);
   // actual line
-  if(ppu->mode == 7) ppu_calculateMode7Starts(ppu, line);
+  if(ppu->lineState.mode == 7) ppu_calculateMode7Starts(ppu, line);
+  // when skipping rendering, pixel composition is not needed as it does not affect any state
+  if(ppu->renderSkip) return;
   for(int x = 0; x < 256; x++) {
     ppu_handlePixel(ppu, x, line);
   }
+  ppu_outputLine(ppu, line, !ppu->lineState.forcedBlank && (ppu->lineState.pseudoHires || ppu->lineState.mode == 5 || ppu->lineState.mode == 6));
+}
+
+void ppu_setPixelOutput(Ppu* ppu, uint8_t* pixels, int pitch, bool allowNarrow) {
+  // pixels needs room for 512 * 478 pixels (4 bytes each, 2 for rgb565 and bgr555), set between frames
+  // interlaced frames write every other line, the other field is kept from the previous frame
+  ppu->pixelOutput = pixels;
+  ppu->pixelOutputPitch = pitch;
+  ppu->pixelOutputNarrow = allowNarrow;
+  ppu->outputWide = !allowNarrow;
+  ppu->outputInvalid = true;
 }
 
 void ppu_setPixelOutputFormat(Ppu* ppu, int pixelOutputFormat) {
   ppu->pixelOutputFormat = pixelOutputFormat;
+  ppu->outputInvalid = true;
+}
+
+void ppu_setRenderSkip(Ppu* ppu, bool skip) {
+  // skip composing and outputting lines, set between frames
+  ppu->renderSkip = skip;
+}
+
+bool ppu_getLineChanged(Ppu* ppu, int row) {
+  // if this row of the pixel output changed during the last rendered frame
+  return ppu->outputLineChanged[row];
+}
+
+void ppu_getOutputSize(Ppu* ppu, int* width, int* height) {
+  // size of the last rendered frame within the pixel output
+  *width = ppu->outputWide ? 512 : 256;
+  *height = (ppu->outputOverscan ? 239 : 224) * (ppu->outputInterlace ? 2 : 1);
+}
+
+static void ppu_outputLine(Ppu* ppu, int line, bool hires) {
+  if(ppu->pixelOutput == NULL) return;
+  if(hires && !ppu->outputWide) {
+    // first hires line in this frame, widen the lines already output
+    ppu_widenOutput(ppu, line - 1);
+    ppu->outputWide = true;
+  }
+  int row = ppu->outputInterlace ? (line - 1) * 2 + (ppu->evenFrame ? 0 : 1) : line - 1;
+  uint8_t* dest = ppu->pixelOutput + row * ppu->pixelOutputPitch;
+  uint32_t pixelData[512]; // converted first, to only write (and mark) changed lines
+  uint8_t* pixels = (uint8_t*) pixelData;
+  uint8_t format = ppu->pixelOutputFormat;
+  // apply brightness, and expand to 8 bit unless outputting bgr555
+  uint8_t levels[32];
+  for(int i = 0; i < 32; i++) {
+    int level = format == ppu_pixelOutputFormatBGR555 ? i : (i << 3) | (i >> 2);
+    levels[i] = level * ppu->lineState.brightness / 15;
+  }
+  int width = ppu->outputWide ? 512 : 256;
+  for(int x = 0; x < width; x++) {
+    // non-hires lines only use the mainscreen pixel, doubled if output is wide
+    uint16_t color = hires ? ppu->lineBuffer[x] : ppu->lineBuffer[(ppu->outputWide ? x >> 1 : x) * 2 + 1];
+    uint8_t r = levels[color & 0x1f];
+    uint8_t g = levels[(color >> 5) & 0x1f];
+    uint8_t b = levels[(color >> 10) & 0x1f];
+    switch(format) {
+      case ppu_pixelOutputFormatXBGR: {
+        pixels[x * 4 + 0] = b;
+        pixels[x * 4 + 1] = g;
+        pixels[x * 4 + 2] = r;
+        pixels[x * 4 + 3] = 0;
+        break;
+      }
+      case ppu_pixelOutputFormatBGRX: {
+        pixels[x * 4 + 0] = 0;
+        pixels[x * 4 + 1] = b;
+        pixels[x * 4 + 2] = g;
+        pixels[x * 4 + 3] = r;
+        break;
+      }
+      case ppu_pixelOutputFormatRGB565: {
+        ((uint16_t*) pixels)[x] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+        break;
+      }
+      case ppu_pixelOutputFormatBGR555: {
+        ((uint16_t*) pixels)[x] = r | (g << 5) | (b << 10);
+        break;
+      }
+    }
+  }
+  int size = width * ppu_getOutputBytesPerPixel(ppu);
+  if(memcmp(dest, pixels, size) != 0) {
+    memcpy(dest, pixels, size);
+    ppu->outputLineChanged[row] = true;
+  }
+  if(ppu->outputBothFields) {
+    // previous frame was not interlaced, the other field does not hold a matching line
+    memcpy(ppu->pixelOutput + (row ^ 1) * ppu->pixelOutputPitch, pixels, size);
+    ppu->outputLineChanged[row ^ 1] = true;
+  }
+}
+
+static void ppu_widenOutput(Ppu* ppu, int rows) {
+  // double each pixel of the 256 wide lines, going backwards to do it in place
+  int bpp = ppu_getOutputBytesPerPixel(ppu);
+  for(int y = 0; y < rows; y++) {
+    uint8_t* line = ppu->pixelOutput + y * ppu->pixelOutputPitch;
+    ppu->outputLineChanged[y] = true;
+    for(int x = 255; x >= 0; x--) {
+      uint8_t pixel[4];
+      memcpy(pixel, line + x * bpp, bpp);
+      memcpy(line + x * bpp * 2, pixel, bpp);
+      memcpy(line + x * bpp * 2 + bpp, pixel, bpp);
+    }
+  }
+}
+
+static int ppu_getOutputBytesPerPixel(Ppu* ppu) {
+  return ppu->pixelOutputFormat >= ppu_pixelOutputFormatRGB565 ? 2 : 4;
 }
 
 static void ppu_handlePixel(Ppu* ppu, int x, int y) {
   int r = 0, r2 = 0;
   int g = 0, g2 = 0;
   int b = 0, b2 = 0;
-  if(!ppu->forcedBlank) {
+  if(!ppu->lineState.forcedBlank) {
     int mainLayer = ppu_getPixel(ppu, x, y, false, &r, &g, &b);
     bool colorWindowState = ppu_getWindowState(ppu, 5, x);
     if(
-      ppu->clipMode == 3 ||
-      (ppu->clipMode == 2 && colorWindowState) ||
-      (ppu->clipMode == 1 && !colorWindowState)
+      ppu->lineState.clipMode == 3 ||
+      (ppu->lineState.clipMode == 2 && colorWindowState) ||
+      (ppu->lineState.clipMode == 1 && !colorWindowState)
     ) {
       r = 0;
       g = 0;
       b = 0;
     }
     int secondLayer = 5; // backdrop
-    bool mathEnabled = mainLayer < 6 && ppu->mathEnabled[mainLayer] && !(
-      ppu->preventMathMode == 3 ||
-      (ppu->preventMathMode == 2 && colorWindowState) ||
-      (ppu->preventMathMode == 1 && !colorWindowState)
+    bool mathEnabled = mainLayer < 6 && ppu->lineState.mathEnabled[mainLayer] && !(
+      ppu->lineState.preventMathMode == 3 ||
+      (ppu->lineState.preventMathMode == 2 && colorWindowState) ||
+      (ppu->lineState.preventMathMode == 1 && !colorWindowState)
     );
-    if((mathEnabled && ppu->addSubscreen) || ppu->pseudoHires || ppu->mode == 5 || ppu->mode == 6) {
+    if((mathEnabled && ppu->lineState.addSubscreen) || ppu->lineState.pseudoHires || ppu->lineState.mode == 5 || ppu->lineState.mode == 6) {
       secondLayer = ppu_getPixel(ppu, x, y, true, &r2, &g2, &b2);
     }
     // TODO: subscreen pixels can be clipped to black as well
     // TODO: math for subscreen pixels (add/sub sub to main)
     if(mathEnabled) {
-      if(ppu->subtractColor) {
-        r -= (ppu->addSubscreen && secondLayer != 5) ? r2 : ppu->fixedColorR;
-        g -= (ppu->addSubscreen && secondLayer != 5) ? g2 : ppu->fixedColorG;
-        b -= (ppu->addSubscreen && secondLayer != 5) ? b2 : ppu->fixedColorB;
+      if(ppu->lineState.subtractColor) {
+        r -= (ppu->lineState.addSubscreen && secondLayer != 5) ? r2 : ppu->lineState.fixedColorR;
+        g -= (ppu->lineState.addSubscreen && secondLayer != 5) ? g2 : ppu->lineState.fixedColorG;
+        b -= (ppu->lineState.addSubscreen && secondLayer != 5) ? b2 : ppu->lineState.fixedColorB;
       } else {
-        r += (ppu->addSubscreen && secondLayer != 5) ? r2 : ppu->fixedColorR;
-        g += (ppu->addSubscreen && secondLayer != 5) ? g2 : ppu->fixedColorG;
-        b += (ppu->addSubscreen && secondLayer != 5) ? b2 : ppu->fixedColorB;
+        r += (ppu->lineState.addSubscreen && secondLayer != 5) ? r2 : ppu->lineState.fixedColorR;
+        g += (ppu->lineState.addSubscreen && secondLayer != 5) ? g2 : ppu->lineState.fixedColorG;
+        b += (ppu->lineState.addSubscreen && secondLayer != 5) ? b2 : ppu->lineState.fixedColorB;
       }
-      if(ppu->halfColor && (secondLayer != 5 || !ppu->addSubscreen)) {
+      if(ppu->lineState.halfColor && (secondLayer != 5 || !ppu->lineState.addSubscreen)) {
         r >>= 1;
         g >>= 1;
         b >>= 1;
@@ -326,24 +450,19 @@ static void ppu_handlePixel(Ppu* ppu, int x, int y) {
       if(g < 0) g = 0;
       if(b < 0) b = 0;
     }
-    if(!(ppu->pseudoHires || ppu->mode == 5 || ppu->mode == 6)) {
+    if(!(ppu->lineState.pseudoHires || ppu->lineState.mode == 5 || ppu->lineState.mode == 6)) {
       r2 = r; g2 = g; b2 = b;
     }
   }
-  int row = (y - 1) + (ppu->evenFrame ? 0 : 239);
-  ppu->pixelBuffer[row * 2048 + x * 8 + 0 + ppu->pixelOutputFormat] = ((b2 << 3) | (b2 >> 2)) * ppu->brightness / 15;
-  ppu->pixelBuffer[row * 2048 + x * 8 + 1 + ppu->pixelOutputFormat] = ((g2 << 3) | (g2 >> 2)) * ppu->brightness / 15;
-  ppu->pixelBuffer[row * 2048 + x * 8 + 2 + ppu->pixelOutputFormat] = ((r2 << 3) | (r2 >> 2)) * ppu->brightness / 15;
-  ppu->pixelBuffer[row * 2048 + x * 8 + 4 + ppu->pixelOutputFormat] = ((b << 3) | (b >> 2)) * ppu->brightness / 15;
-  ppu->pixelBuffer[row * 2048 + x * 8 + 5 + ppu->pixelOutputFormat] = ((g << 3) | (g >> 2)) * ppu->brightness / 15;
-  ppu->pixelBuffer[row * 2048 + x * 8 + 6 + ppu->pixelOutputFormat] = ((r << 3) | (r >> 2)) * ppu->brightness / 15;
+  ppu->lineBuffer[x * 2] = r2 | (g2 << 5) | (b2 << 10);
+  ppu->lineBuffer[x * 2 + 1] = r | (g << 5) | (b << 10);
 }
 
 static int ppu_getPixel(Ppu* ppu, int x, int y, bool sub, int* r, int* g, int* b) {
   // figure out which color is on this location on main- or subscreen, sets it in r, g, b
   // returns which layer it is: 0-3 for bg layer, 4 or 6 for sprites (depending on palette), 5 for backdrop
-  int actMode = ppu->mode == 1 && ppu->bg3priority ? 8 : ppu->mode;
-  actMode = ppu->mode == 7 && ppu->m7extBg ? 9 : actMode;
+  int actMode = ppu->lineState.mode == 1 && ppu->lineState.bg3priority ? 8 : ppu->lineState.mode;
+  actMode = ppu->lineState.mode == 7 && ppu->lineState.m7extBg ? 9 : actMode;
   int layer = 5;
   int pixel = 0;
   for(int i = 0; i < layerCountPerMode[actMode]; i++) {
@@ -351,12 +470,12 @@ static int ppu_getPixel(Ppu* ppu, int x, int y, bool sub, int* r, int* g, int* b
     int curPriority = prioritysPerMode[actMode][i];
     bool layerActive = false;
     if(!sub) {
-      layerActive = ppu->layer[curLayer].mainScreenEnabled && (
-        !ppu->layer[curLayer].mainScreenWindowed || !ppu_getWindowState(ppu, curLayer, x)
+      layerActive = ppu->lineState.layer[curLayer].mainScreenEnabled && (
+        !ppu->lineState.layer[curLayer].mainScreenWindowed || !ppu_getWindowState(ppu, curLayer, x)
       );
     } else {
-      layerActive = ppu->layer[curLayer].subScreenEnabled && (
-        !ppu->layer[curLayer].subScreenWindowed || !ppu_getWindowState(ppu, curLayer, x)
+      layerActive = ppu->lineState.layer[curLayer].subScreenEnabled && (
+        !ppu->lineState.layer[curLayer].subScreenWindowed || !ppu_getWindowState(ppu, curLayer, x)
       );
     }
     if(layerActive) {
@@ -364,24 +483,24 @@ static int ppu_getPixel(Ppu* ppu, int x, int y, bool sub, int* r, int* g, int* b
         // bg layer
         int lx = x;
         int ly = y;
-        if(ppu->bgLayer[curLayer].mosaicEnabled && ppu->mosaicSize > 1) {
-          lx -= lx % ppu->mosaicSize;
-          ly -= (ly - ppu->mosaicStartLine) % ppu->mosaicSize;
+        if(ppu->lineState.bgLayer[curLayer].mosaicEnabled && ppu->lineState.mosaicSize > 1) {
+          lx -= lx % ppu->lineState.mosaicSize;
+          ly -= (ly - ppu->lineState.mosaicStartLine) % ppu->lineState.mosaicSize;
         }
-        if(ppu->mode == 7) {
+        if(ppu->lineState.mode == 7) {
           pixel = ppu_getPixelForMode7(ppu, lx, curLayer, curPriority);
         } else {
-          lx += ppu->bgLayer[curLayer].hScroll;
-          if(ppu->mode == 5 || ppu->mode == 6) {
+          lx += ppu->lineState.bgLayer[curLayer].hScroll;
+          if(ppu->lineState.mode == 5 || ppu->lineState.mode == 6) {
             lx *= 2;
-            lx += (sub || ppu->bgLayer[curLayer].mosaicEnabled) ? 0 : 1;
+            lx += (sub || ppu->lineState.bgLayer[curLayer].mosaicEnabled) ? 0 : 1;
             if(ppu->interlace) {
               ly *= 2;
-              ly += (ppu->evenFrame || ppu->bgLayer[curLayer].mosaicEnabled) ? 0 : 1;
+              ly += (ppu->evenFrame || ppu->lineState.bgLayer[curLayer].mosaicEnabled) ? 0 : 1;
             }
           }
-          ly += ppu->bgLayer[curLayer].vScroll;
-          if(ppu->mode == 2 || ppu->mode == 4 || ppu->mode == 6) {
+          ly += ppu->lineState.bgLayer[curLayer].vScroll;
+          if(ppu->lineState.mode == 2 || ppu->lineState.mode == 4 || ppu->lineState.mode == 6) {
             ppu_handleOPT(ppu, curLayer, &lx, &ly);
           }
           pixel = ppu_getPixelForBgLayer(
@@ -400,7 +519,7 @@ static int ppu_getPixel(Ppu* ppu, int x, int y, bool sub, int* r, int* g, int* b
       break;
     }
   }
-  if(ppu->directColor && layer < 4 && bitDepthsPerMode[actMode][layer] == 8) {
+  if(ppu->lineState.directColor && layer < 4 && bitDepthsPerMode[actMode][layer] == 8) {
     *r = ((pixel & 0x7) << 2) | ((pixel & 0x100) >> 7);
     *g = ((pixel & 0x38) >> 1) | ((pixel & 0x200) >> 8);
     *b = ((pixel & 0xc0) >> 3) | ((pixel & 0x400) >> 8);
@@ -418,17 +537,17 @@ static void ppu_handleOPT(Ppu* ppu, int layer, int* lx, int* ly) {
   int x = *lx;
   int y = *ly;
   int column = 0;
-  if(ppu->mode == 6) {
-    column = ((x - (x & 0xf)) - ((ppu->bgLayer[layer].hScroll * 2) & 0xfff0)) >> 4;
+  if(ppu->lineState.mode == 6) {
+    column = ((x - (x & 0xf)) - ((ppu->lineState.bgLayer[layer].hScroll * 2) & 0xfff0)) >> 4;
   } else {
-    column = ((x - (x & 0x7)) - (ppu->bgLayer[layer].hScroll & 0xfff8)) >> 3;
+    column = ((x - (x & 0x7)) - (ppu->lineState.bgLayer[layer].hScroll & 0xfff8)) >> 3;
   }
   if(column > 0) {
     // fetch offset values from layer 3 tilemap
     int valid = layer == 0 ? 0x2000 : 0x4000;
     uint16_t hOffset = ppu_getOffsetValue(ppu, column - 1, 0);
     uint16_t vOffset = 0;
-    if(ppu->mode == 4) {
+    if(ppu->lineState.mode == 4) {
       if(hOffset & 0x8000) {
         vOffset = hOffset;
         hOffset = 0;
@@ -436,38 +555,38 @@ static void ppu_handleOPT(Ppu* ppu, int layer, int* lx, int* ly) {
     } else {
       vOffset = ppu_getOffsetValue(ppu, column - 1, 1);
     }
-    if(ppu->mode == 6) {
+    if(ppu->lineState.mode == 6) {
       // TODO: not sure if correct
       if(hOffset & valid) *lx = (((hOffset & 0x3f8) + (column * 8)) * 2) | (x & 0xf);
     } else {
       if(hOffset & valid) *lx = ((hOffset & 0x3f8) + (column * 8)) | (x & 0x7);
     }
     // TODO: not sure if correct for interlace
-    if(vOffset & valid) *ly = (vOffset & 0x3ff) + (y - ppu->bgLayer[layer].vScroll);
+    if(vOffset & valid) *ly = (vOffset & 0x3ff) + (y - ppu->lineState.bgLayer[layer].vScroll);
   }
 }
 
 static uint16_t ppu_getOffsetValue(Ppu* ppu, int col, int row) {
-  int x = col * 8 + ppu->bgLayer[2].hScroll;
-  int y = row * 8 + ppu->bgLayer[2].vScroll;
-  int tileBits = ppu->bgLayer[2].bigTiles ? 4 : 3;
-  int tileHighBit = ppu->bgLayer[2].bigTiles ? 0x200 : 0x100;
-  uint16_t tilemapAdr = ppu->bgLayer[2].tilemapAdr + (((y >> tileBits) & 0x1f) << 5 | ((x >> tileBits) & 0x1f));
-  if((x & tileHighBit) && ppu->bgLayer[2].tilemapWider) tilemapAdr += 0x400;
-  if((y & tileHighBit) && ppu->bgLayer[2].tilemapHigher) tilemapAdr += ppu->bgLayer[2].tilemapWider ? 0x800 : 0x400;
+  int x = col * 8 + ppu->lineState.bgLayer[2].hScroll;
+  int y = row * 8 + ppu->lineState.bgLayer[2].vScroll;
+  int tileBits = ppu->lineState.bgLayer[2].bigTiles ? 4 : 3;
+  int tileHighBit = ppu->lineState.bgLayer[2].bigTiles ? 0x200 : 0x100;
+  uint16_t tilemapAdr = ppu->lineState.bgLayer[2].tilemapAdr + (((y >> tileBits) & 0x1f) << 5 | ((x >> tileBits) & 0x1f));
+  if((x & tileHighBit) && ppu->lineState.bgLayer[2].tilemapWider) tilemapAdr += 0x400;
+  if((y & tileHighBit) && ppu->lineState.bgLayer[2].tilemapHigher) tilemapAdr += ppu->lineState.bgLayer[2].tilemapWider ? 0x800 : 0x400;
   return ppu->vram[tilemapAdr & 0x7fff];
 }
 
 static int ppu_getPixelForBgLayer(Ppu* ppu, int x, int y, int layer, bool priority) {
   // figure out address of tilemap word and read it
-  bool wideTiles = ppu->bgLayer[layer].bigTiles || ppu->mode == 5 || ppu->mode == 6;
+  bool wideTiles = ppu->lineState.bgLayer[layer].bigTiles || ppu->lineState.mode == 5 || ppu->lineState.mode == 6;
   int tileBitsX = wideTiles ? 4 : 3;
   int tileHighBitX = wideTiles ? 0x200 : 0x100;
-  int tileBitsY = ppu->bgLayer[layer].bigTiles ? 4 : 3;
-  int tileHighBitY = ppu->bgLayer[layer].bigTiles ? 0x200 : 0x100;
-  uint16_t tilemapAdr = ppu->bgLayer[layer].tilemapAdr + (((y >> tileBitsY) & 0x1f) << 5 | ((x >> tileBitsX) & 0x1f));
-  if((x & tileHighBitX) && ppu->bgLayer[layer].tilemapWider) tilemapAdr += 0x400;
-  if((y & tileHighBitY) && ppu->bgLayer[layer].tilemapHigher) tilemapAdr += ppu->bgLayer[layer].tilemapWider ? 0x800 : 0x400;
+  int tileBitsY = ppu->lineState.bgLayer[layer].bigTiles ? 4 : 3;
+  int tileHighBitY = ppu->lineState.bgLayer[layer].bigTiles ? 0x200 : 0x100;
+  uint16_t tilemapAdr = ppu->lineState.bgLayer[layer].tilemapAdr + (((y >> tileBitsY) & 0x1f) << 5 | ((x >> tileBitsX) & 0x1f));
+  if((x & tileHighBitX) && ppu->lineState.bgLayer[layer].tilemapWider) tilemapAdr += 0x400;
+  if((y & tileHighBitY) && ppu->lineState.bgLayer[layer].tilemapHigher) tilemapAdr += ppu->lineState.bgLayer[layer].tilemapWider ? 0x800 : 0x400;
   uint16_t tile = ppu->vram[tilemapAdr & 0x7fff];
   // check priority, get palette
   if(((bool) (tile & 0x2000)) != priority) return 0; // wrong priority
@@ -480,32 +599,32 @@ static int ppu_getPixelForBgLayer(Ppu* ppu, int x, int y, int layer, bool priori
     // if unflipped right half of tile, or flipped left half of tile
     if(((bool) (x & 8)) ^ ((bool) (tile & 0x4000))) tileNum += 1;
   }
-  if(ppu->bgLayer[layer].bigTiles) {
+  if(ppu->lineState.bgLayer[layer].bigTiles) {
     // if unflipped bottom half of tile, or flipped upper half of tile
     if(((bool) (y & 8)) ^ ((bool) (tile & 0x8000))) tileNum += 0x10;
   }
   // read tiledata, ajust palette for mode 0
-  int bitDepth = bitDepthsPerMode[ppu->mode][layer];
-  if(ppu->mode == 0) paletteNum += 8 * layer;
+  int bitDepth = bitDepthsPerMode[ppu->lineState.mode][layer];
+  if(ppu->lineState.mode == 0) paletteNum += 8 * layer;
   // plane 1 (always)
   int paletteSize = 4;
-  uint16_t plane1 = ppu->vram[(ppu->bgLayer[layer].tileAdr + ((tileNum & 0x3ff) * 4 * bitDepth) + row) & 0x7fff];
+  uint16_t plane1 = ppu->vram[(ppu->lineState.bgLayer[layer].tileAdr + ((tileNum & 0x3ff) * 4 * bitDepth) + row) & 0x7fff];
   int pixel = (plane1 >> col) & 1;
   pixel |= ((plane1 >> (8 + col)) & 1) << 1;
   // plane 2 (for 4bpp, 8bpp)
   if(bitDepth > 2) {
     paletteSize = 16;
-    uint16_t plane2 = ppu->vram[(ppu->bgLayer[layer].tileAdr + ((tileNum & 0x3ff) * 4 * bitDepth) + 8 + row) & 0x7fff];
+    uint16_t plane2 = ppu->vram[(ppu->lineState.bgLayer[layer].tileAdr + ((tileNum & 0x3ff) * 4 * bitDepth) + 8 + row) & 0x7fff];
     pixel |= ((plane2 >> col) & 1) << 2;
     pixel |= ((plane2 >> (8 + col)) & 1) << 3;
   }
   // plane 3 & 4 (for 8bpp)
   if(bitDepth > 4) {
     paletteSize = 256;
-    uint16_t plane3 = ppu->vram[(ppu->bgLayer[layer].tileAdr + ((tileNum & 0x3ff) * 4 * bitDepth) + 16 + row) & 0x7fff];
+    uint16_t plane3 = ppu->vram[(ppu->lineState.bgLayer[layer].tileAdr + ((tileNum & 0x3ff) * 4 * bitDepth) + 16 + row) & 0x7fff];
     pixel |= ((plane3 >> col) & 1) << 4;
     pixel |= ((plane3 >> (8 + col)) & 1) << 5;
-    uint16_t plane4 = ppu->vram[(ppu->bgLayer[layer].tileAdr + ((tileNum & 0x3ff) * 4 * bitDepth) + 24 + row) & 0x7fff];
+    uint16_t plane4 = ppu->vram[(ppu->lineState.bgLayer[layer].tileAdr + ((tileNum & 0x3ff) * 4 * bitDepth) + 24 + row) & 0x7fff];
     pixel |= ((plane4 >> col) & 1) << 6;
     pixel |= ((plane4 >> (8 + col)) & 1) << 7;
   }
@@ -515,43 +634,43 @@ static int ppu_getPixelForBgLayer(Ppu* ppu, int x, int y, int layer, bool priori
 
 static void ppu_calculateMode7Starts(Ppu* ppu, int y) {
   // expand 13-bit values to signed values
-  int hScroll = ((int16_t) (ppu->m7matrix[6] << 3)) >> 3;
-  int vScroll = ((int16_t) (ppu->m7matrix[7] << 3)) >> 3;
-  int xCenter = ((int16_t) (ppu->m7matrix[4] << 3)) >> 3;
-  int yCenter = ((int16_t) (ppu->m7matrix[5] << 3)) >> 3;
+  int hScroll = ((int16_t) (ppu->lineState.m7matrix[6] << 3)) >> 3;
+  int vScroll = ((int16_t) (ppu->lineState.m7matrix[7] << 3)) >> 3;
+  int xCenter = ((int16_t) (ppu->lineState.m7matrix[4] << 3)) >> 3;
+  int yCenter = ((int16_t) (ppu->lineState.m7matrix[5] << 3)) >> 3;
   // do calculation
   int clippedH = hScroll - xCenter;
   int clippedV = vScroll - yCenter;
   clippedH = (clippedH & 0x2000) ? (clippedH | ~1023) : (clippedH & 1023);
   clippedV = (clippedV & 0x2000) ? (clippedV | ~1023) : (clippedV & 1023);
-  if(ppu->bgLayer[0].mosaicEnabled && ppu->mosaicSize > 1) {
-    y -= (y - ppu->mosaicStartLine) % ppu->mosaicSize;
+  if(ppu->lineState.bgLayer[0].mosaicEnabled && ppu->lineState.mosaicSize > 1) {
+    y -= (y - ppu->lineState.mosaicStartLine) % ppu->lineState.mosaicSize;
   }
-  uint8_t ry = ppu->m7yFlip ? 255 - y : y;
+  uint8_t ry = ppu->lineState.m7yFlip ? 255 - y : y;
   ppu->m7startX = (
-    ((ppu->m7matrix[0] * clippedH) & ~63) +
-    ((ppu->m7matrix[1] * ry) & ~63) +
-    ((ppu->m7matrix[1] * clippedV) & ~63) +
+    ((ppu->lineState.m7matrix[0] * clippedH) & ~63) +
+    ((ppu->lineState.m7matrix[1] * ry) & ~63) +
+    ((ppu->lineState.m7matrix[1] * clippedV) & ~63) +
     (xCenter << 8)
   );
   ppu->m7startY = (
-    ((ppu->m7matrix[2] * clippedH) & ~63) +
-    ((ppu->m7matrix[3] * ry) & ~63) +
-    ((ppu->m7matrix[3] * clippedV) & ~63) +
+    ((ppu->lineState.m7matrix[2] * clippedH) & ~63) +
+    ((ppu->lineState.m7matrix[3] * ry) & ~63) +
+    ((ppu->lineState.m7matrix[3] * clippedV) & ~63) +
     (yCenter << 8)
   );
 }
 
 static int ppu_getPixelForMode7(Ppu* ppu, int x, int layer, bool priority) {
-  uint8_t rx = ppu->m7xFlip ? 255 - x : x;
-  int xPos = (ppu->m7startX + ppu->m7matrix[0] * rx) >> 8;
-  int yPos = (ppu->m7startY + ppu->m7matrix[2] * rx) >> 8;
+  uint8_t rx = ppu->lineState.m7xFlip ? 255 - x : x;
+  int xPos = (ppu->m7startX + ppu->lineState.m7matrix[0] * rx) >> 8;
+  int yPos = (ppu->m7startY + ppu->lineState.m7matrix[2] * rx) >> 8;
   bool outsideMap = xPos < 0 || xPos >= 1024 || yPos < 0 || yPos >= 1024;
   xPos &= 0x3ff;
   yPos &= 0x3ff;
-  if(!ppu->m7largeField) outsideMap = false;
+  if(!ppu->lineState.m7largeField) outsideMap = false;
   uint8_t tile = outsideMap ? 0 : ppu->vram[(yPos >> 3) * 128 + (xPos >> 3)] & 0xff;
-  uint8_t pixel = outsideMap && !ppu->m7charFill ? 0 : ppu->vram[tile * 64 + (yPos & 7) * 8 + (xPos & 7)] >> 8;
+  uint8_t pixel = outsideMap && !ppu->lineState.m7charFill ? 0 : ppu->vram[tile * 64 + (yPos & 7) * 8 + (xPos & 7)] >> 8;
   if(layer == 1) {
     if(((bool) (pixel & 0x80)) != priority) return 0;
     return pixel & 0x7f;
@@ -560,22 +679,22 @@ static int ppu_getPixelForMode7(Ppu* ppu, int x, int layer, bool priority) {
 }
 
 static bool ppu_getWindowState(Ppu* ppu, int layer, int x) {
-  if(!ppu->windowLayer[layer].window1enabled && !ppu->windowLayer[layer].window2enabled) {
+  if(!ppu->lineState.windowLayer[layer].window1enabled && !ppu->lineState.windowLayer[layer].window2enabled) {
     return false;
   }
-  if(ppu->windowLayer[layer].window1enabled && !ppu->windowLayer[layer].window2enabled) {
-    bool test = x >= ppu->window1left && x <= ppu->window1right;
-    return ppu->windowLayer[layer].window1inversed ? !test : test;
+  if(ppu->lineState.windowLayer[layer].window1enabled && !ppu->lineState.windowLayer[layer].window2enabled) {
+    bool test = x >= ppu->lineState.window1left && x <= ppu->lineState.window1right;
+    return ppu->lineState.windowLayer[layer].window1inversed ? !test : test;
   }
-  if(!ppu->windowLayer[layer].window1enabled && ppu->windowLayer[layer].window2enabled) {
-    bool test = x >= ppu->window2left && x <= ppu->window2right;
-    return ppu->windowLayer[layer].window2inversed ? !test : test;
+  if(!ppu->lineState.windowLayer[layer].window1enabled && ppu->lineState.windowLayer[layer].window2enabled) {
+    bool test = x >= ppu->lineState.window2left && x <= ppu->lineState.window2right;
+    return ppu->lineState.windowLayer[layer].window2inversed ? !test : test;
   }
-  bool test1 = x >= ppu->window1left && x <= ppu->window1right;
-  bool test2 = x >= ppu->window2left && x <= ppu->window2right;
-  if(ppu->windowLayer[layer].window1inversed) test1 = !test1;
-  if(ppu->windowLayer[layer].window2inversed) test2 = !test2;
-  switch(ppu->windowLayer[layer].maskLogic) {
+  bool test1 = x >= ppu->lineState.window1left && x <= ppu->lineState.window1right;
+  bool test2 = x >= ppu->lineState.window2left && x <= ppu->lineState.window2right;
+  if(ppu->lineState.windowLayer[layer].window1inversed) test1 = !test1;
+  if(ppu->lineState.windowLayer[layer].window2inversed) test2 = !test2;
+  switch(ppu->lineState.windowLayer[layer].maskLogic) {
     case 0: return test1 || test2;
     case 1: return test1 && test2;
     case 2: return test1 != test2;
@@ -693,7 +812,7 @@ uint8_t ppu_read(Ppu* ppu, uint8_t adr) {
     case 0x34:
     case 0x35:
     case 0x36: {
-      int result = ppu->m7matrix[0] * (ppu->m7matrix[1] >> 8);
+      int result = ppu->lineState.m7matrix[0] * (ppu->lineState.m7matrix[1] >> 8);
       ppu->ppu1openBus = (result >> (8 * (adr - 0x34))) & 0xff;
       return ppu->ppu1openBus;
     }
@@ -805,8 +924,8 @@ void ppu_write(Ppu* ppu, uint8_t adr, uint8_t val) {
   switch(adr) {
     case 0x00: {
       // TODO: oam address reset when written on first line of vblank, (and when forced blank is disabled?)
-      ppu->brightness = val & 0xf;
-      ppu->forcedBlank = val & 0x80;
+      ppu->lineState.brightness = val & 0xf;
+      ppu->lineState.forcedBlank = val & 0x80;
       break;
     }
     case 0x01: {
@@ -833,6 +952,7 @@ void ppu_write(Ppu* ppu, uint8_t adr, uint8_t val) {
     case 0x04: {
       if(ppu->oamInHigh) {
         ppu->highOam[((ppu->oamAdr & 0xf) << 1) | ppu->oamSecondWrite] = val;
+        ppu->highOamDirty[0] = true;
         if(ppu->oamSecondWrite) {
           ppu->oamAdr++;
           if(ppu->oamAdr == 0) ppu->oamInHigh = false;
@@ -841,6 +961,7 @@ void ppu_write(Ppu* ppu, uint8_t adr, uint8_t val) {
         if(!ppu->oamSecondWrite) {
           ppu->oamBuffer = val;
         } else {
+          ppu->oamDirty[ppu->oamAdr >> 7] = true;
           ppu->oam[ppu->oamAdr++] = (val << 8) | ppu->oamBuffer;
           if(ppu->oamAdr == 0) ppu->oamInHigh = true;
         }
@@ -849,65 +970,65 @@ void ppu_write(Ppu* ppu, uint8_t adr, uint8_t val) {
       break;
     }
     case 0x05: {
-      ppu->mode = val & 0x7;
-      ppu->bg3priority = val & 0x8;
-      ppu->bgLayer[0].bigTiles = val & 0x10;
-      ppu->bgLayer[1].bigTiles = val & 0x20;
-      ppu->bgLayer[2].bigTiles = val & 0x40;
-      ppu->bgLayer[3].bigTiles = val & 0x80;
+      ppu->lineState.mode = val & 0x7;
+      ppu->lineState.bg3priority = val & 0x8;
+      ppu->lineState.bgLayer[0].bigTiles = val & 0x10;
+      ppu->lineState.bgLayer[1].bigTiles = val & 0x20;
+      ppu->lineState.bgLayer[2].bigTiles = val & 0x40;
+      ppu->lineState.bgLayer[3].bigTiles = val & 0x80;
       break;
     }
     case 0x06: {
       // TODO: mosaic line reset specifics
-      ppu->bgLayer[0].mosaicEnabled = val & 0x1;
-      ppu->bgLayer[1].mosaicEnabled = val & 0x2;
-      ppu->bgLayer[2].mosaicEnabled = val & 0x4;
-      ppu->bgLayer[3].mosaicEnabled = val & 0x8;
-      ppu->mosaicSize = (val >> 4) + 1;
-      ppu->mosaicStartLine = ppu->snes->vPos;
+      ppu->lineState.bgLayer[0].mosaicEnabled = val & 0x1;
+      ppu->lineState.bgLayer[1].mosaicEnabled = val & 0x2;
+      ppu->lineState.bgLayer[2].mosaicEnabled = val & 0x4;
+      ppu->lineState.bgLayer[3].mosaicEnabled = val & 0x8;
+      ppu->lineState.mosaicSize = (val >> 4) + 1;
+      ppu->lineState.mosaicStartLine = ppu->snes->vPos;
       break;
     }
     case 0x07:
     case 0x08:
     case 0x09:
     case 0x0a: {
-      ppu->bgLayer[adr - 7].tilemapWider = val & 0x1;
-      ppu->bgLayer[adr - 7].tilemapHigher = val & 0x2;
-      ppu->bgLayer[adr - 7].tilemapAdr = (val & 0xfc) << 8;
+      ppu->lineState.bgLayer[adr - 7].tilemapWider = val & 0x1;
+      ppu->lineState.bgLayer[adr - 7].tilemapHigher = val & 0x2;
+      ppu->lineState.bgLayer[adr - 7].tilemapAdr = (val & 0xfc) << 8;
       break;
     }
     case 0x0b: {
-      ppu->bgLayer[0].tileAdr = (val & 0xf) << 12;
-      ppu->bgLayer[1].tileAdr = (val & 0xf0) << 8;
+      ppu->lineState.bgLayer[0].tileAdr = (val & 0xf) << 12;
+      ppu->lineState.bgLayer[1].tileAdr = (val & 0xf0) << 8;
       break;
     }
     case 0x0c: {
-      ppu->bgLayer[2].tileAdr = (val & 0xf) << 12;
-      ppu->bgLayer[3].tileAdr = (val & 0xf0) << 8;
+      ppu->lineState.bgLayer[2].tileAdr = (val & 0xf) << 12;
+      ppu->lineState.bgLayer[3].tileAdr = (val & 0xf0) << 8;
       break;
     }
     case 0x0d: {
-      ppu->m7matrix[6] = ((val << 8) | ppu->m7prev) & 0x1fff;
+      ppu->lineState.m7matrix[6] = ((val << 8) | ppu->m7prev) & 0x1fff;
       ppu->m7prev = val;
       // fallthrough to normal layer BG-HOFS
     }
     case 0x0f:
     case 0x11:
     case 0x13: {
-      ppu->bgLayer[(adr - 0xd) / 2].hScroll = ((val << 8) | (ppu->scrollPrev & 0xf8) | (ppu->scrollPrev2 & 0x7)) & 0x3ff;
+      ppu->lineState.bgLayer[(adr - 0xd) / 2].hScroll = ((val << 8) | (ppu->scrollPrev & 0xf8) | (ppu->scrollPrev2 & 0x7)) & 0x3ff;
       ppu->scrollPrev = val;
       ppu->scrollPrev2 = val;
       break;
     }
     case 0x0e: {
-      ppu->m7matrix[7] = ((val << 8) | ppu->m7prev) & 0x1fff;
+      ppu->lineState.m7matrix[7] = ((val << 8) | ppu->m7prev) & 0x1fff;
       ppu->m7prev = val;
       // fallthrough to normal layer BG-VOFS
     }
     case 0x10:
     case 0x12:
     case 0x14: {
-      ppu->bgLayer[(adr - 0xe) / 2].vScroll = ((val << 8) | ppu->scrollPrev) & 0x3ff;
+      ppu->lineState.bgLayer[(adr - 0xe) / 2].vScroll = ((val << 8) | ppu->scrollPrev) & 0x3ff;
       ppu->scrollPrev = val;
       break;
     }
@@ -937,33 +1058,35 @@ void ppu_write(Ppu* ppu, uint8_t adr, uint8_t val) {
       // TODO: vram access during rendering (also cgram and oam)
       uint16_t vramAdr = ppu_getVramRemap(ppu);
       ppu->vram[vramAdr & 0x7fff] = (ppu->vram[vramAdr & 0x7fff] & 0xff00) | val;
+      ppu->vramDirty[(vramAdr & 0x7fff) >> 7] = true;
       if(!ppu->vramIncrementOnHigh) ppu->vramPointer += ppu->vramIncrement;
       break;
     }
     case 0x19: {
       uint16_t vramAdr = ppu_getVramRemap(ppu);
       ppu->vram[vramAdr & 0x7fff] = (ppu->vram[vramAdr & 0x7fff] & 0x00ff) | (val << 8);
+      ppu->vramDirty[(vramAdr & 0x7fff) >> 7] = true;
       if(ppu->vramIncrementOnHigh) ppu->vramPointer += ppu->vramIncrement;
       break;
     }
     case 0x1a: {
-      ppu->m7largeField = val & 0x80;
-      ppu->m7charFill = val & 0x40;
-      ppu->m7yFlip = val & 0x2;
-      ppu->m7xFlip = val & 0x1;
+      ppu->lineState.m7largeField = val & 0x80;
+      ppu->lineState.m7charFill = val & 0x40;
+      ppu->lineState.m7yFlip = val & 0x2;
+      ppu->lineState.m7xFlip = val & 0x1;
       break;
     }
     case 0x1b:
     case 0x1c:
     case 0x1d:
     case 0x1e: {
-      ppu->m7matrix[adr - 0x1b] = (val << 8) | ppu->m7prev;
+      ppu->lineState.m7matrix[adr - 0x1b] = (val << 8) | ppu->m7prev;
       ppu->m7prev = val;
       break;
     }
     case 0x1f:
     case 0x20: {
-      ppu->m7matrix[adr - 0x1b] = ((val << 8) | ppu->m7prev) & 0x1fff;
+      ppu->lineState.m7matrix[adr - 0x1b] = ((val << 8) | ppu->m7prev) & 0x1fff;
       ppu->m7prev = val;
       break;
     }
@@ -976,6 +1099,7 @@ void ppu_write(Ppu* ppu, uint8_t adr, uint8_t val) {
       if(!ppu->cgramSecondWrite) {
         ppu->cgramBuffer = val;
       } else {
+        ppu->cgramDirty[ppu->cgramPointer >> 7] = true;
         ppu->cgram[ppu->cgramPointer++] = (val << 8) | ppu->cgramBuffer;
       }
       ppu->cgramSecondWrite = !ppu->cgramSecondWrite;
@@ -984,103 +1108,103 @@ void ppu_write(Ppu* ppu, uint8_t adr, uint8_t val) {
     case 0x23:
     case 0x24:
     case 0x25: {
-      ppu->windowLayer[(adr - 0x23) * 2].window1inversed = val & 0x1;
-      ppu->windowLayer[(adr - 0x23) * 2].window1enabled = val & 0x2;
-      ppu->windowLayer[(adr - 0x23) * 2].window2inversed = val & 0x4;
-      ppu->windowLayer[(adr - 0x23) * 2].window2enabled = val & 0x8;
-      ppu->windowLayer[(adr - 0x23) * 2 + 1].window1inversed = val & 0x10;
-      ppu->windowLayer[(adr - 0x23) * 2 + 1].window1enabled = val & 0x20;
-      ppu->windowLayer[(adr - 0x23) * 2 + 1].window2inversed = val & 0x40;
-      ppu->windowLayer[(adr - 0x23) * 2 + 1].window2enabled = val & 0x80;
+      ppu->lineState.windowLayer[(adr - 0x23) * 2].window1inversed = val & 0x1;
+      ppu->lineState.windowLayer[(adr - 0x23) * 2].window1enabled = val & 0x2;
+      ppu->lineState.windowLayer[(adr - 0x23) * 2].window2inversed = val & 0x4;
+      ppu->lineState.windowLayer[(adr - 0x23) * 2].window2enabled = val & 0x8;
+      ppu->lineState.windowLayer[(adr - 0x23) * 2 + 1].window1inversed = val & 0x10;
+      ppu->lineState.windowLayer[(adr - 0x23) * 2 + 1].window1enabled = val & 0x20;
+      ppu->lineState.windowLayer[(adr - 0x23) * 2 + 1].window2inversed = val & 0x40;
+      ppu->lineState.windowLayer[(adr - 0x23) * 2 + 1].window2enabled = val & 0x80;
       break;
     }
     case 0x26: {
-      ppu->window1left = val;
+      ppu->lineState.window1left = val;
       break;
     }
     case 0x27: {
-      ppu->window1right = val;
+      ppu->lineState.window1right = val;
       break;
     }
     case 0x28: {
-      ppu->window2left = val;
+      ppu->lineState.window2left = val;
       break;
     }
     case 0x29: {
-      ppu->window2right = val;
+      ppu->lineState.window2right = val;
       break;
     }
     case 0x2a: {
-      ppu->windowLayer[0].maskLogic = val & 0x3;
-      ppu->windowLayer[1].maskLogic = (val >> 2) & 0x3;
-      ppu->windowLayer[2].maskLogic = (val >> 4) & 0x3;
-      ppu->windowLayer[3].maskLogic = (val >> 6) & 0x3;
+      ppu->lineState.windowLayer[0].maskLogic = val & 0x3;
+      ppu->lineState.windowLayer[1].maskLogic = (val >> 2) & 0x3;
+      ppu->lineState.windowLayer[2].maskLogic = (val >> 4) & 0x3;
+      ppu->lineState.windowLayer[3].maskLogic = (val >> 6) & 0x3;
       break;
     }
     case 0x2b: {
-      ppu->windowLayer[4].maskLogic = val & 0x3;
-      ppu->windowLayer[5].maskLogic = (val >> 2) & 0x3;
+      ppu->lineState.windowLayer[4].maskLogic = val & 0x3;
+      ppu->lineState.windowLayer[5].maskLogic = (val >> 2) & 0x3;
       break;
     }
     case 0x2c: {
-      ppu->layer[0].mainScreenEnabled = val & 0x1;
-      ppu->layer[1].mainScreenEnabled = val & 0x2;
-      ppu->layer[2].mainScreenEnabled = val & 0x4;
-      ppu->layer[3].mainScreenEnabled = val & 0x8;
-      ppu->layer[4].mainScreenEnabled = val & 0x10;
+      ppu->lineState.layer[0].mainScreenEnabled = val & 0x1;
+      ppu->lineState.layer[1].mainScreenEnabled = val & 0x2;
+      ppu->lineState.layer[2].mainScreenEnabled = val & 0x4;
+      ppu->lineState.layer[3].mainScreenEnabled = val & 0x8;
+      ppu->lineState.layer[4].mainScreenEnabled = val & 0x10;
       break;
     }
     case 0x2d: {
-      ppu->layer[0].subScreenEnabled = val & 0x1;
-      ppu->layer[1].subScreenEnabled = val & 0x2;
-      ppu->layer[2].subScreenEnabled = val & 0x4;
-      ppu->layer[3].subScreenEnabled = val & 0x8;
-      ppu->layer[4].subScreenEnabled = val & 0x10;
+      ppu->lineState.layer[0].subScreenEnabled = val & 0x1;
+      ppu->lineState.layer[1].subScreenEnabled = val & 0x2;
+      ppu->lineState.layer[2].subScreenEnabled = val & 0x4;
+      ppu->lineState.layer[3].subScreenEnabled = val & 0x8;
+      ppu->lineState.layer[4].subScreenEnabled = val & 0x10;
       break;
     }
     case 0x2e: {
-      ppu->layer[0].mainScreenWindowed = val & 0x1;
-      ppu->layer[1].mainScreenWindowed = val & 0x2;
-      ppu->layer[2].mainScreenWindowed = val & 0x4;
-      ppu->layer[3].mainScreenWindowed = val & 0x8;
-      ppu->layer[4].mainScreenWindowed = val & 0x10;
+      ppu->lineState.layer[0].mainScreenWindowed = val & 0x1;
+      ppu->lineState.layer[1].mainScreenWindowed = val & 0x2;
+      ppu->lineState.layer[2].mainScreenWindowed = val & 0x4;
+      ppu->lineState.layer[3].mainScreenWindowed = val & 0x8;
+      ppu->lineState.layer[4].mainScreenWindowed = val & 0x10;
       break;
     }
     case 0x2f: {
-      ppu->layer[0].subScreenWindowed = val & 0x1;
-      ppu->layer[1].subScreenWindowed = val & 0x2;
-      ppu->layer[2].subScreenWindowed = val & 0x4;
-      ppu->layer[3].subScreenWindowed = val & 0x8;
-      ppu->layer[4].subScreenWindowed = val & 0x10;
+      ppu->lineState.layer[0].subScreenWindowed = val & 0x1;
+      ppu->lineState.layer[1].subScreenWindowed = val & 0x2;
+      ppu->lineState.layer[2].subScreenWindowed = val & 0x4;
+      ppu->lineState.layer[3].subScreenWindowed = val & 0x8;
+      ppu->lineState.layer[4].subScreenWindowed = val & 0x10;
       break;
     }
     case 0x30: {
-      ppu->directColor = val & 0x1;
-      ppu->addSubscreen = val & 0x2;
-      ppu->preventMathMode = (val & 0x30) >> 4;
-      ppu->clipMode = (val & 0xc0) >> 6;
+      ppu->lineState.directColor = val & 0x1;
+      ppu->lineState.addSubscreen = val & 0x2;
+      ppu->lineState.preventMathMode = (val & 0x30) >> 4;
+      ppu->lineState.clipMode = (val & 0xc0) >> 6;
       break;
     }
     case 0x31: {
-      ppu->subtractColor = val & 0x80;
-      ppu->halfColor = val & 0x40;
+      ppu->lineState.subtractColor = val & 0x80;
+      ppu->lineState.halfColor = val & 0x40;
       for(int i = 0; i < 6; i++) {
-        ppu->mathEnabled[i] = val & (1 << i);
+        ppu->lineState.mathEnabled[i] = val & (1 << i);
       }
       break;
     }
     case 0x32: {
-      if(val & 0x80) ppu->fixedColorB = val & 0x1f;
-      if(val & 0x40) ppu->fixedColorG = val & 0x1f;
-      if(val & 0x20) ppu->fixedColorR = val & 0x1f;
+      if(val & 0x80) ppu->lineState.fixedColorB = val & 0x1f;
+      if(val & 0x40) ppu->lineState.fixedColorG = val & 0x1f;
+      if(val & 0x20) ppu->lineState.fixedColorR = val & 0x1f;
       break;
     }
     case 0x33: {
       ppu->interlace = val & 0x1;
       ppu->objInterlace = val & 0x2;
       ppu->overscan = val & 0x4;
-      ppu->pseudoHires = val & 0x8;
-      ppu->m7extBg = val & 0x40;
+      ppu->lineState.pseudoHires = val & 0x8;
+      ppu->lineState.m7extBg = val & 0x40;
       break;
     }
     default: {
@@ -1088,22 +1212,3 @@ void ppu_write(Ppu* ppu, uint8_t adr, uint8_t val) {
     }
   }
 }
-
-void ppu_putPixels(Ppu* ppu, uint8_t* pixels) {
-  for(int y = 0; y < (ppu->frameOverscan ? 239 : 224); y++) {
-    int dest = y * 2 + (ppu->frameOverscan ? 2 : 16);
-    int y1 = y, y2 = y + 239;
-    if(!ppu->frameInterlace) {
-      y1 = y + (ppu->evenFrame ? 0 : 239);
-      y2 = y1;
-    }
-    memcpy(pixels + (dest * 2048), &ppu->pixelBuffer[y1 * 2048], 2048);
-    memcpy(pixels + ((dest + 1) * 2048), &ppu->pixelBuffer[y2 * 2048], 2048);
-  }
-  // clear top 2 lines, and following 14 and last 16 lines if not overscanning
-  memset(pixels, 0, 2048 * 2);
-  if(!ppu->frameOverscan) {
-    memset(pixels + (2 * 2048), 0, 2048 * 14);
-    memset(pixels + (464 * 2048), 0, 2048 * 16);
-  }
-}
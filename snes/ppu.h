@@ -36,10 +36,53 @@ typedef struct WindowLayer {
   uint8_t maskLogic;
 } WindowLayer;
 
+// registers used by the line renderer, kept together in one block
+// so they share few cache lines and can be copied as a whole to capture the state for a line
+typedef struct PpuLineState {
+  // background layers
+  BgLayer bgLayer[4];
+  uint8_t mosaicSize;
+  uint8_t mosaicStartLine;
+  // layers
+  Layer layer[5];
+  // windows
+  WindowLayer windowLayer[6];
+  uint8_t window1left;
+  uint8_t window1right;
+  uint8_t window2left;
+  uint8_t window2right;
+  // mode 7
+  int16_t m7matrix[8]; // a, b, c, d, x, y, h, v
+  bool m7largeField;
+  bool m7charFill;
+  bool m7xFlip;
+  bool m7yFlip;
+  bool m7extBg;
+  // color math
+  uint8_t clipMode;
+  uint8_t preventMathMode;
+  bool addSubscreen;
+  bool subtractColor;
+  bool halfColor;
+  bool mathEnabled[6];
+  uint8_t fixedColorR;
+  uint8_t fixedColorG;
+  uint8_t fixedColorB;
+  // settings
+  bool forcedBlank;
+  uint8_t brightness;
+  uint8_t mode;
+  bool bg3priority;
+  bool pseudoHires;
+  bool directColor;
+} PpuLineState;
+
 struct Ppu {
+  // line render state, on its own cache line(s)
+  _Alignas(64) PpuLineState lineState;
   Snes* snes;
   // vram access
-  uint16_t vram[0x8000];
+  uint16_t* vram; // 64K, placed at the end of the snes memory
   uint16_t vramPointer;
   bool vramIncrementOnHigh;
   uint16_t vramIncrement;
@@ -69,53 +112,19 @@ struct Ppu {
   bool timeOver;
   bool rangeOver;
   bool objInterlace;
-  // background layers
-  BgLayer bgLayer[4];
+  // scrolling / mode 7 latches
   uint8_t scrollPrev;
   uint8_t scrollPrev2;
-  uint8_t mosaicSize;
-  uint8_t mosaicStartLine;
-  // layers
-  Layer layer[5];
-  // mode 7
-  int16_t m7matrix[8]; // a, b, c, d, x, y, h, v
   uint8_t m7prev;
-  bool m7largeField;
-  bool m7charFill;
-  bool m7xFlip;
-  bool m7yFlip;
-  bool m7extBg;
   // mode 7 internal
   int32_t m7startX;
   int32_t m7startY;
-  // windows
-  WindowLayer windowLayer[6];
-  uint8_t window1left;
-  uint8_t window1right;
-  uint8_t window2left;
-  uint8_t window2right;
-  // color math
-  uint8_t clipMode;
-  uint8_t preventMathMode;
-  bool addSubscreen;
-  bool subtractColor;
-  bool halfColor;
-  bool mathEnabled[6];
-  uint8_t fixedColorR;
-  uint8_t fixedColorG;
-  uint8_t fixedColorB;
-  // settings
-  bool forcedBlank;
-  uint8_t brightness;
-  uint8_t mode;
-  bool bg3priority;
+  // frame state
   bool evenFrame;
-  bool pseudoHires;
   bool overscan;
   bool frameOverscan; // if we are overscanning this frame (determined at 0,225)
   bool interlace;
   bool frameInterlace; // if we are interlacing this frame (determined at start vblank)
-  bool directColor;
   // latching
   uint16_t hCount;
   uint16_t vCount;
@@ -124,16 +133,35 @@ struct Ppu {
   bool countersLatched;
   uint8_t ppu1openBus;
   uint8_t ppu2openBus;
-  // pixel buffer (xbgr)
-  // times 2 for even and odd frame
-  uint8_t pixelBuffer[512 * 4 * 239 * 2];
+  // line buffer (bgr555), even entries for subscreen / left half, odd entries for mainscreen / right half
+  uint16_t lineBuffer[512];
+  // pixel output, lines are rendered directly into the caller-provided buffer
+  uint8_t* pixelOutput;
+  int pixelOutputPitch;
   uint8_t pixelOutputFormat;
+  bool pixelOutputNarrow; // if frames without hires lines can be output 256 wide
+  bool outputWide; // if this frame is output 512 wide (set when the first hires line is seen)
+  bool outputInterlace; // if this frame is output interlaced (determined at 0,0)
+  bool outputBothFields; // if the first interlaced frame, also fill the other field
+  bool outputOverscan; // if the last rendered frame was overscanned
+  bool outputLineChanged[478]; // per row of the pixel output, if written with different contents this frame
+  bool outputInvalid; // if the pixel output or format changed, all rows are reported as changed for the next frame
+  bool renderSkip; // if lines are not rendered (sprite evaluation and mode 7 latching still happen)
+  // dirty pages (256 bytes each)
+  bool vramDirty[0x100];
+  bool cgramDirty[2];
+  bool oamDirty[2];
+  bool highOamDirty[1];
 };
 
-enum { ppu_pixelOutputFormatXBGR = 0, ppu_pixelOutputFormatBGRX = 1 };
+enum {
+  ppu_pixelOutputFormatXBGR = 0,
+  ppu_pixelOutputFormatBGRX = 1,
+  ppu_pixelOutputFormatRGB565 = 2,
+  ppu_pixelOutputFormatBGR555 = 3
+};
 
-Ppu* ppu_init(Snes* snes);
-void ppu_free(Ppu* ppu);
+void ppu_init(Ppu* ppu, Snes* snes, uint16_t* vram);
 void ppu_reset(Ppu* ppu);
 void ppu_handleState(Ppu* ppu, StateHandler* sh);
 bool ppu_checkOverscan(Ppu* ppu);
@@ -142,7 +170,10 @@ void ppu_handleFrameStart(Ppu* ppu);
 void ppu_runLine(Ppu* ppu, int line);
 uint8_t ppu_read(Ppu* ppu, uint8_t adr);
 void ppu_write(Ppu* ppu, uint8_t adr, uint8_t val);
-void ppu_putPixels(Ppu* ppu, uint8_t* pixels);
+void ppu_setPixelOutput(Ppu* ppu, uint8_t* pixels, int pitch, bool allowNarrow);
 void ppu_setPixelOutputFormat(Ppu* ppu, int pixelOutputFormat);
+void ppu_setRenderSkip(Ppu* ppu, bool skip);
+bool ppu_getLineChanged(Ppu* ppu, int row);
+void ppu_getOutputSize(Ppu* ppu, int* width, int* height);
 
 #endif
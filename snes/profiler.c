@@ -0,0 +1,154 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "profiler.h"
+
+static void profiler_addStack(Profiler* profiler, int processor, CallStack* stack);
+static uint32_t profiler_findEntry(Profiler* profiler, uint64_t hash, int processor, CallStack* stack);
+static void profiler_grow(Profiler* profiler);
+
+Profiler* profiler_init(int interval) {
+  // interval is the amount of master cycles between samples (21477 for about 1000 samples per second)
+  Profiler* profiler = malloc(sizeof(Profiler));
+  profiler->interval = interval;
+  profiler->lastSample = 0;
+  // the spc is sampled on its own clock (1.024 MHz, converted with the ntsc master clock)
+  profiler->spcInterval = (uint32_t) ((uint64_t) interval * 32040 * 32 / (1364 * 262 * 60));
+  if(profiler->spcInterval == 0) profiler->spcInterval = 1;
+  profiler->lastSpcSample = 0;
+  profiler->mask = 0x3ff;
+  profiler->entries = malloc((profiler->mask + 1) * sizeof(ProfileEntry));
+  profiler->frameCapacity = 0x1000;
+  profiler->frames = malloc(profiler->frameCapacity * sizeof(uint32_t));
+  profiler_clear(profiler);
+  return profiler;
+}
+
+void profiler_free(Profiler* profiler) {
+  free(profiler->entries);
+  free(profiler->frames);
+  free(profiler);
+}
+
+void profiler_clear(Profiler* profiler) {
+  // clears the samples and the call stacks
+  memset(profiler->entries, 0, (profiler->mask + 1) * sizeof(ProfileEntry));
+  profiler->used = 0;
+  profiler->frameCount = 0;
+  profiler->samples = 0;
+  profiler->cpuStack.depth = 0;
+  profiler->spcStack.depth = 0;
+}
+
+void profiler_call(CallStack* stack, uint32_t target, uint16_t sp) {
+  // calls nested deeper than profilerMaxDepth are attributed to the deepest one kept
+  if(stack->depth == profilerMaxDepth) return;
+  stack->targets[stack->depth] = target;
+  stack->sps[stack->depth] = sp;
+  stack->depth++;
+}
+
+void profiler_return(CallStack* stack, uint16_t sp) {
+  // drops all calls made with a lower stack pointer, so that returns are matched even if the
+  // code adjusts the stack itself (pulling the return address, or returning through a different routine)
+  while(stack->depth > 0 && stack->sps[stack->depth - 1] < sp) stack->depth--;
+}
+
+void profiler_sampleCpu(Profiler* profiler, uint64_t cycle) {
+  // called from the scheduler once interval master cycles have passed
+  profiler->lastSample = cycle;
+  profiler->samples++;
+  profiler_addStack(profiler, 0, &profiler->cpuStack);
+}
+
+void profiler_sampleSpc(Profiler* profiler, uint32_t apuCycle) {
+  // called from the apu once spcInterval apu cycles have passed, as the spc only runs when it is caught up
+  profiler->lastSpcSample = apuCycle;
+  profiler_addStack(profiler, 1, &profiler->spcStack);
+}
+
+int profiler_writeFolded(Profiler* profiler, char* text) {
+  // writes the samples in the folded stack format used by flamegraph tools, a line per unique stack:
+  // processor;main;called address;called address... count
+  // returns the size (without a terminating \0), text can be NULL to only get the size
+  int size = 0;
+  char line[profilerMaxDepth * 8 + 64];
+  for(uint32_t i = 0; i <= profiler->mask; i++) {
+    ProfileEntry* entry = &profiler->entries[i];
+    if(entry->hash == 0) continue;
+    int length = sprintf(line, "%s;main", entry->processor == 0 ? "cpu" : "spc");
+    for(int j = 0; j < entry->depth; j++) {
+      uint32_t target = profiler->frames[entry->offset + j];
+      if(entry->processor == 0) {
+        length += sprintf(line + length, ";%02x:%04x", target >> 16, target & 0xffff);
+      } else {
+        length += sprintf(line + length, ";%04x", target);
+      }
+    }
+    length += sprintf(line + length, " %llu\n", (unsigned long long) entry->count);
+    if(text != NULL) memcpy(text + size, line, length);
+    size += length;
+  }
+  return size;
+}
+
+static void profiler_addStack(Profiler* profiler, int processor, CallStack* stack) {
+  uint64_t hash = 0xcbf29ce484222325 ^ processor;
+  for(int i = 0; i < stack->depth; i++) hash = (hash ^ stack->targets[i]) * 0x100000001b3;
+  if(hash == 0) hash = 1;
+  uint32_t index = profiler_findEntry(profiler, hash, processor, stack);
+  ProfileEntry* entry = &profiler->entries[index];
+  if(entry->hash != 0) {
+    entry->count++;
+    return;
+  }
+  // new stack
+  if(profiler->frameCount + stack->depth > profiler->frameCapacity) {
+    while(profiler->frameCount + stack->depth > profiler->frameCapacity) profiler->frameCapacity *= 2;
+    profiler->frames = realloc(profiler->frames, profiler->frameCapacity * sizeof(uint32_t));
+  }
+  memcpy(profiler->frames + profiler->frameCount, stack->targets, stack->depth * sizeof(uint32_t));
+  entry->hash = hash;
+  entry->offset = profiler->frameCount;
+  entry->processor = processor;
+  entry->depth = stack->depth;
+  entry->count = 1;
+  profiler->frameCount += stack->depth;
+  profiler->used++;
+  if(profiler->used * 2 > profiler->mask) profiler_grow(profiler);
+}
+
+static uint32_t profiler_findEntry(Profiler* profiler, uint64_t hash, int processor, CallStack* stack) {
+  // returns the index of the entry for the stack, or of the free entry to put it in
+  uint32_t index = hash & profiler->mask;
+  while(true) {
+    ProfileEntry* entry = &profiler->entries[index];
+    if(entry->hash == 0) return index;
+    if(
+      entry->hash == hash && entry->processor == processor && entry->depth == stack->depth &&
+      memcmp(profiler->frames + entry->offset, stack->targets, stack->depth * sizeof(uint32_t)) == 0
+    ) {
+      return index;
+    }
+    index = (index + 1) & profiler->mask;
+  }
+}
+
+static void profiler_grow(Profiler* profiler) {
+  // doubles the size of the entry table
+  ProfileEntry* old = profiler->entries;
+  uint32_t oldMask = profiler->mask;
+  profiler->mask = oldMask * 2 + 1;
+  profiler->entries = calloc(profiler->mask + 1, sizeof(ProfileEntry));
+  for(uint32_t i = 0; i <= oldMask; i++) {
+    if(old[i].hash == 0) continue;
+    uint32_t index = old[i].hash & profiler->mask;
+    while(profiler->entries[index].hash != 0) index = (index + 1) & profiler->mask;
+    profiler->entries[index] = old[i];
+  }
+  free(old);
+}
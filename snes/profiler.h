@@ -0,0 +1,51 @@
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+enum { profilerMaxDepth = 64 };
+
+typedef struct CallStack {
+  // shadow call stack, kept by the cpu or spc while profiling
+  uint32_t targets[profilerMaxDepth]; // called address (bank << 16 | pc)
+  uint16_t sps[profilerMaxDepth]; // stack pointer after the call
+  int depth;
+} CallStack;
+
+typedef struct ProfileEntry {
+  uint64_t hash; // 0 for an unused entry
+  uint32_t offset; // in frames
+  uint8_t processor; // 0 for cpu, 1 for spc
+  uint8_t depth;
+  uint64_t count;
+} ProfileEntry;
+
+typedef struct Profiler {
+  uint32_t interval; // master cycles between cpu samples
+  uint64_t lastSample; // master cycle of the last cpu sample
+  uint32_t spcInterval; // apu cycles between spc samples, about the same time as interval
+  uint32_t lastSpcSample; // apu cycle of the last spc sample
+  CallStack cpuStack;
+  CallStack spcStack;
+  // unique stacks with their sample counts, their frames are stored in frames
+  ProfileEntry* entries;
+  uint32_t mask;
+  uint32_t used;
+  uint32_t* frames;
+  int frameCount;
+  int frameCapacity;
+  uint64_t samples; // cpu samples, the spc gets about as many
+} Profiler;
+
+Profiler* profiler_init(int interval);
+void profiler_free(Profiler* profiler);
+void profiler_clear(Profiler* profiler);
+void profiler_call(CallStack* stack, uint32_t target, uint16_t sp);
+void profiler_return(CallStack* stack, uint16_t sp);
+void profiler_sampleCpu(Profiler* profiler, uint64_t cycle);
+void profiler_sampleSpc(Profiler* profiler, uint32_t apuCycle);
+int profiler_writeFolded(Profiler* profiler, char* text);
+
+#endif
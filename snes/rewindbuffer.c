@@ -0,0 +1,242 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "rewindbuffer.h"
+#include "snes.h"
+
+#define MINIZ_HEADER_FILE_ONLY
+#include "miniz.h"
+
+static void rb_setStateSize(RewindBuffer* rb, int size);
+static RewindEntry* rb_getEntry(RewindBuffer* rb, int index);
+static void rb_removeOldest(RewindBuffer* rb);
+static int rb_compress(RewindBuffer* rb, const uint8_t* data, int size);
+static int rb_decompress(RewindEntry* entry, uint8_t* data, int size);
+static int rb_encodeDelta(RewindBuffer* rb);
+static void rb_applyDelta(const uint8_t* encoded, int length, uint8_t* data);
+static int rb_writeLength(uint8_t* data, int value);
+static int rb_readLength(const uint8_t* data, int* offset);
+
+RewindBuffer* rb_init(Snes* snes, int budget, int keyframeInterval) {
+  // budget is the maximum size of the compressed entries in bytes, keyframeInterval the amount of entries per keyframe
+  RewindBuffer* rb = malloc(sizeof(RewindBuffer));
+  rb->snes = snes;
+  rb->budget = budget;
+  rb->keyframeInterval = keyframeInterval;
+  rb->capacity = 64;
+  rb->entries = malloc(rb->capacity * sizeof(RewindEntry));
+  rb->first = 0;
+  rb->count = 0;
+  rb->usedSize = 0;
+  rb->sinceKeyframe = 0;
+  rb->stateSize = 0;
+  rb->current = NULL;
+  rb->state = NULL;
+  rb->encoded = NULL;
+  rb->compressed = NULL;
+  rb->compressedSize = 0;
+  rb->compressor = malloc(sizeof(tdefl_compressor));
+  return rb;
+}
+
+void rb_free(RewindBuffer* rb) {
+  rb_clear(rb);
+  free(rb->entries);
+  free(rb->current);
+  free(rb->state);
+  free(rb->encoded);
+  free(rb->compressed);
+  free(rb->compressor);
+  free(rb);
+}
+
+void rb_clear(RewindBuffer* rb) {
+  while(rb->count > 0) rb_removeOldest(rb);
+  rb->first = 0;
+  rb->sinceKeyframe = 0;
+}
+
+void rb_push(RewindBuffer* rb) {
+  // adds the current state as newest entry, called once per frame
+  int size = snes_saveState(rb->snes, NULL);
+  if(size != rb->stateSize) {
+    // different rom loaded, older entries can't be used anymore
+    rb_clear(rb);
+    rb_setStateSize(rb, size);
+  }
+  snes_saveState(rb->snes, rb->state);
+  RewindEntry entry;
+  entry.keyframe = rb->count == 0 || rb->sinceKeyframe >= rb->keyframeInterval;
+  if(entry.keyframe) {
+    entry.size = rb_compress(rb, rb->state, size);
+    rb->sinceKeyframe = 1;
+  } else {
+    entry.size = rb_compress(rb, rb->encoded, rb_encodeDelta(rb));
+    rb->sinceKeyframe++;
+  }
+  entry.data = malloc(entry.size);
+  memcpy(entry.data, rb->compressed, entry.size);
+  // the new state is now the current one
+  uint8_t* temp = rb->current;
+  rb->current = rb->state;
+  rb->state = temp;
+  // add it
+  if(rb->count == rb->capacity) {
+    RewindEntry* entries = malloc(rb->capacity * 2 * sizeof(RewindEntry));
+    for(int i = 0; i < rb->count; i++) entries[i] = *rb_getEntry(rb, i);
+    free(rb->entries);
+    rb->entries = entries;
+    rb->capacity *= 2;
+    rb->first = 0;
+  }
+  rb->count++;
+  *rb_getEntry(rb, rb->count - 1) = entry;
+  rb->usedSize += entry.size;
+  // remove the oldest keyframe and its deltas while over budget, but always keep the newest keyframe
+  while(rb->usedSize > rb->budget) {
+    int next = 1;
+    while(next < rb->count && !rb_getEntry(rb, next)->keyframe) next++;
+    if(next == rb->count) break;
+    for(int i = 0; i < next; i++) rb_removeOldest(rb);
+  }
+}
+
+bool rb_step(RewindBuffer* rb) {
+  // removes the newest entry and loads the state of the one before it
+  // if only one entry is left it is loaded and kept, and false is returned
+  if(rb->count == 0) return false;
+  if(rb->count == 1) {
+    snes_loadState(rb->snes, rb->current, rb->stateSize);
+    return false;
+  }
+  RewindEntry* entry = rb_getEntry(rb, rb->count - 1);
+  if(!entry->keyframe) {
+    // deltas are a xor, so applying it again gives the state before it
+    int length = rb_decompress(entry, rb->encoded, rb->stateSize * 2 + 16);
+    rb_applyDelta(rb->encoded, length, rb->current);
+  } else {
+    // rebuild from the keyframe before it
+    int index = rb->count - 2;
+    while(!rb_getEntry(rb, index)->keyframe) index--;
+    rb_decompress(rb_getEntry(rb, index), rb->current, rb->stateSize);
+    for(int i = index + 1; i < rb->count - 1; i++) {
+      int length = rb_decompress(rb_getEntry(rb, i), rb->encoded, rb->stateSize * 2 + 16);
+      rb_applyDelta(rb->encoded, length, rb->current);
+    }
+  }
+  rb->usedSize -= entry->size;
+  free(entry->data);
+  rb->count--;
+  // count entries since the now newest keyframe
+  int index = rb->count - 1;
+  while(!rb_getEntry(rb, index)->keyframe) index--;
+  rb->sinceKeyframe = rb->count - index;
+  snes_loadState(rb->snes, rb->current, rb->stateSize);
+  return true;
+}
+
+int rb_getCount(RewindBuffer* rb) {
+  return rb->count;
+}
+
+static void rb_setStateSize(RewindBuffer* rb, int size) {
+  // encoded deltas are at most 1.5 times the state size, plus the final run lengths
+  rb->stateSize = size;
+  rb->current = realloc(rb->current, size);
+  rb->state = realloc(rb->state, size);
+  rb->encoded = realloc(rb->encoded, size * 2 + 16);
+  rb->compressedSize = mz_compressBound(size * 2 + 16);
+  rb->compressed = realloc(rb->compressed, rb->compressedSize);
+}
+
+static RewindEntry* rb_getEntry(RewindBuffer* rb, int index) {
+  // index 0 is the oldest entry
+  return &rb->entries[(rb->first + index) % rb->capacity];
+}
+
+static void rb_removeOldest(RewindBuffer* rb) {
+  RewindEntry* entry = rb_getEntry(rb, 0);
+  rb->usedSize -= entry->size;
+  free(entry->data);
+  rb->first = (rb->first + 1) % rb->capacity;
+  rb->count--;
+}
+
+static int rb_compress(RewindBuffer* rb, const uint8_t* data, int size) {
+  // compresses into rb->compressed as raw deflate, favouring speed
+  tdefl_init(rb->compressor, NULL, NULL, tdefl_create_comp_flags_from_zip_params(MZ_BEST_SPEED, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY));
+  size_t inSize = size;
+  size_t outSize = rb->compressedSize;
+  tdefl_compress(rb->compressor, data, &inSize, rb->compressed, &outSize, TDEFL_FINISH);
+  return outSize;
+}
+
+static int rb_decompress(RewindEntry* entry, uint8_t* data, int size) {
+  size_t length = tinfl_decompress_mem_to_mem(data, size, entry->data, entry->size, 0);
+  return length == TINFL_DECOMPRESS_MEM_TO_MEM_FAILED ? 0 : length;
+}
+
+static int rb_encodeDelta(RewindBuffer* rb) {
+  // encodes rb->state xor rb->current into rb->encoded, as pairs of runs:
+  // length of unchanged bytes, length of changed bytes, changed bytes (xored)
+  const uint8_t* a = rb->state;
+  const uint8_t* b = rb->current;
+  int size = rb->stateSize;
+  int pos = 0;
+  int length = 0;
+  while(pos < size) {
+    int start = pos;
+    // skip unchanged bytes, 8 at a time
+    while(pos + 8 <= size) {
+      uint64_t wordA, wordB;
+      memcpy(&wordA, a + pos, 8);
+      memcpy(&wordB, b + pos, 8);
+      if(wordA != wordB) break;
+      pos += 8;
+    }
+    while(pos < size && a[pos] == b[pos]) pos++;
+    length += rb_writeLength(rb->encoded + length, pos - start);
+    start = pos;
+    while(pos < size && a[pos] != b[pos]) pos++;
+    length += rb_writeLength(rb->encoded + length, pos - start);
+    for(int i = start; i < pos; i++) rb->encoded[length++] = a[i] ^ b[i];
+  }
+  return length;
+}
+
+static void rb_applyDelta(const uint8_t* encoded, int length, uint8_t* data) {
+  int offset = 0;
+  int pos = 0;
+  while(offset < length) {
+    pos += rb_readLength(encoded, &offset);
+    int changed = rb_readLength(encoded, &offset);
+    for(int i = 0; i < changed; i++) data[pos++] ^= encoded[offset++];
+  }
+}
+
+static int rb_writeLength(uint8_t* data, int value) {
+  // 7 bits per byte, high bit set if more bytes follow
+  int length = 0;
+  while(value >= 0x80) {
+    data[length++] = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  data[length++] = value;
+  return length;
+}
+
+static int rb_readLength(const uint8_t* data, int* offset) {
+  int value = 0;
+  int shift = 0;
+  while(true) {
+    uint8_t val = data[(*offset)++];
+    value |= (val & 0x7f) << shift;
+    if((val & 0x80) == 0) break;
+    shift += 7;
+  }
+  return value;
+}
@@ -0,0 +1,45 @@
+
+#ifndef REWINDBUFFER_H
+#define REWINDBUFFER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "snes.h"
+
+typedef struct RewindEntry {
+  uint8_t* data; // compressed
+  int size;
+  bool keyframe; // full state, else xor/rle delta against the entry before it
+} RewindEntry;
+
+typedef struct RewindBuffer {
+  Snes* snes;
+  // settings
+  int budget; // maximum total size of the compressed entries
+  int keyframeInterval;
+  // ring of entries, oldest first
+  RewindEntry* entries;
+  int capacity;
+  int first;
+  int count;
+  int usedSize; // total size of the compressed entries
+  int sinceKeyframe; // entries since the last keyframe
+  // working buffers
+  int stateSize;
+  uint8_t* current; // state of the newest entry
+  uint8_t* state; // new state / decoded entry
+  uint8_t* encoded; // rle-encoded delta
+  uint8_t* compressed;
+  int compressedSize;
+  void* compressor;
+} RewindBuffer;
+
+RewindBuffer* rb_init(Snes* snes, int budget, int keyframeInterval);
+void rb_free(RewindBuffer* rb);
+void rb_clear(RewindBuffer* rb);
+void rb_push(RewindBuffer* rb);
+bool rb_step(RewindBuffer* rb);
+int rb_getCount(RewindBuffer* rb);
+
+#endif
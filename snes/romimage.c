@@ -0,0 +1,139 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "romimage.h"
+
+static RomImage* rom_init(void);
+static void rom_freeContents(RomImage* rom);
+
+RomImage* rom_initFromData(const uint8_t* data, int size, int capacity) {
+  RomImage* rom = rom_init();
+  rom_setData(rom, data, size, capacity);
+  return rom;
+}
+
+RomImage* rom_initFromFile(const char* path) {
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if(file == INVALID_HANDLE_VALUE) return NULL;
+  LARGE_INTEGER fileSize;
+  if(!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+    CloseHandle(file);
+    return NULL;
+  }
+  HANDLE mappingHandle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if(mappingHandle == NULL) return NULL;
+  void* mapping = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mappingHandle); // the view keeps the mapping alive
+  if(mapping == NULL) return NULL;
+  size_t size = fileSize.QuadPart;
+#else
+  int file = open(path, O_RDONLY);
+  if(file < 0) return NULL;
+  struct stat info;
+  if(fstat(file, &info) != 0 || info.st_size == 0) {
+    close(file);
+    return NULL;
+  }
+  size_t size = info.st_size;
+  void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file); // the mapping keeps the file open
+  if(mapping == MAP_FAILED) return NULL;
+#endif
+  RomImage* rom = rom_init();
+  rom->mapping = mapping;
+  rom->mappingSize = size;
+  rom->data = mapping;
+  rom->size = size;
+  rom->mirroredSize = size;
+  return rom;
+}
+
+void rom_setData(RomImage* rom, const uint8_t* data, int size, int capacity) {
+  // capacity (at least size) bytes are allocated, the space after size can be filled in through rom->allocation
+  // data can point into the current contents
+  uint8_t* allocation = malloc(capacity);
+  memcpy(allocation, data, size);
+  rom_freeContents(rom);
+  rom->allocation = allocation;
+  rom->data = allocation;
+  rom->size = size;
+  rom->mirroredSize = size;
+}
+
+void rom_setMirroredSize(RomImage* rom, int mirroredSize) {
+  // mirrors the same way as repeatedly doubling the last part: for each set bit in the size (lowest first),
+  // the last block of that size is repeated, until the size reaches mirroredSize (so 3 MB becomes 0-2, 2-3, 2-3)
+  // size needs to be a multiple of 4K
+  free(rom->pages);
+  rom->pages = NULL;
+  rom->mirroredSize = mirroredSize;
+  if(mirroredSize == rom->size) return;
+  rom->pages = malloc((mirroredSize >> 12) * sizeof(uint32_t));
+  int length = rom->size >> 12;
+  for(int i = 0; i < length; i++) rom->pages[i] = i << 12;
+  int test = 1;
+  while(length != mirroredSize >> 12) {
+    if(length & test) {
+      for(int i = 0; i < test; i++) rom->pages[length + i] = rom->pages[length - test + i];
+      length += test;
+    }
+    test *= 2;
+  }
+}
+
+void rom_retain(RomImage* rom) {
+  atomic_fetch_add(&rom->refs, 1);
+}
+
+void rom_release(RomImage* rom) {
+  if(atomic_fetch_sub(&rom->refs, 1) == 1) {
+    rom_freeContents(rom);
+    free(rom->pages);
+    free(rom);
+  }
+}
+
+static RomImage* rom_init(void) {
+  RomImage* rom = malloc(sizeof(RomImage));
+  rom->data = NULL;
+  rom->size = 0;
+  rom->mirroredSize = 0;
+  rom->pages = NULL;
+  atomic_init(&rom->refs, 1);
+  rom->allocation = NULL;
+  rom->mapping = NULL;
+  rom->mappingSize = 0;
+  rom->type = 0;
+  rom->pal = false;
+  rom->ramSize = 0;
+  return rom;
+}
+
+static void rom_freeContents(RomImage* rom) {
+  if(rom->allocation != NULL) free(rom->allocation);
+  if(rom->mapping != NULL) {
+#ifdef _WIN32
+    UnmapViewOfFile(rom->mapping);
+#else
+    munmap(rom->mapping, rom->mappingSize);
+#endif
+  }
+  rom->allocation = NULL;
+  rom->mapping = NULL;
+  rom->mappingSize = 0;
+}
@@ -0,0 +1,33 @@
+
+#ifndef ROMIMAGE_H
+#define ROMIMAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+typedef struct RomImage {
+  const uint8_t* data; // rom contents (past a copier header)
+  uint32_t size;
+  uint32_t mirroredSize; // size as seen by the cart, a power of 2
+  uint32_t* pages; // offset in data per 4K page of mirroredSize, NULL if mirroredSize is the actual size
+  atomic_int refs; // amount of users, freed when it reaches 0
+  // how the contents are held
+  uint8_t* allocation; // malloc'd copy, or NULL
+  void* mapping; // mapped file, or NULL
+  size_t mappingSize;
+  // from the header, set by snes_createRom / snes_openRom
+  uint8_t type;
+  bool pal;
+  uint32_t ramSize;
+} RomImage;
+
+RomImage* rom_initFromData(const uint8_t* data, int size, int capacity); // copies the data
+RomImage* rom_initFromFile(const char* path); // maps the file read-only, NULL if it can't
+void rom_setData(RomImage* rom, const uint8_t* data, int size, int capacity); // replaces the contents with a copy of data
+void rom_setMirroredSize(RomImage* rom, int mirroredSize); // sets up the page offsets to mirror the contents
+void rom_retain(RomImage* rom);
+void rom_release(RomImage* rom);
+
+#endif
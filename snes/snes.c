@@ -13,41 +13,89 @@
 #include "ppu.h"
 #include "cart.h"
 #include "input.h"
+#include "movie.h"
 #include "statehandler.h"
 
 static const double apuCyclesPerMaster = (32040 * 32) / (1364 * 262 * 60.0);
 static const double apuCyclesPerMasterPal = (32040 * 32) / (1364 * 312 * 50.0);
 
 static void snes_runCycle(Snes* snes);
+static bool snes_canRunFast(Snes* snes, int steps);
+static void snes_runCyclesFast(Snes* snes, int steps);
+static void snes_checkIrq(Snes* snes);
 static void snes_catchupApu(Snes* snes);
 static void snes_doAutoJoypad(Snes* snes);
 static uint8_t snes_readReg(Snes* snes, uint16_t adr);
 static void snes_writeReg(Snes* snes, uint16_t adr, uint8_t val);
 static uint8_t snes_rread(Snes* snes, uint32_t adr); // wrapped by read, to set open bus
 static int snes_getAccessTime(Snes* snes, uint32_t adr);
+static void snes_logCpuRead(Snes* snes, uint32_t adr);
+
+// all components are placed in one block, with the small, often accessed ones first
+// and the large memories at the end
+typedef struct SnesMemory {
+  Snes snes;
+  Cpu cpu;
+  Dma dma;
+  Apu apu;
+  Spc spc;
+  Dsp dsp;
+  Input input1;
+  Input input2;
+  Cart cart;
+  Ppu ppu;
+  const uint8_t* readPages[0x1000];
+  uint16_t ppuVram[0x8000];
+  uint8_t apuRam[0x10000];
+  uint8_t ram[0x20000];
+} SnesMemory;
 
 Snes* snes_init(void) {
-  Snes* snes = malloc(sizeof(Snes));
-  snes->cpu = cpu_init(snes, snes_cpuRead, snes_cpuWrite, snes_cpuIdle);
-  snes->apu = apu_init(snes);
-  snes->dma = dma_init(snes);
-  snes->ppu = ppu_init(snes);
-  snes->cart = cart_init(snes);
-  snes->input1 = input_init(snes);
-  snes->input2 = input_init(snes);
+  // over-allocate to be able to align to 64 bytes
+  void* allocation = malloc(sizeof(SnesMemory) + 63);
+  Snes* snes = snes_initInto((void*) (((uintptr_t) allocation + 63) & ~(uintptr_t) 63));
+  snes->allocation = allocation;
+  return snes;
+}
+
+int snes_getMemorySize(void) {
+  return sizeof(SnesMemory);
+}
+
+Snes* snes_initInto(void* memory) {
+  // memory needs to be snes_getMemorySize() bytes, aligned to 64 bytes
+  // it has to stay valid until snes_free is called, which won't free it
+  SnesMemory* mem = memory;
+  Snes* snes = &mem->snes;
+  snes->cpu = &mem->cpu;
+  snes->apu = &mem->apu;
+  snes->dma = &mem->dma;
+  snes->ppu = &mem->ppu;
+  snes->cart = &mem->cart;
+  snes->input1 = &mem->input1;
+  snes->input2 = &mem->input2;
+  snes->ram = mem->ram;
+  snes->readPages = mem->readPages;
+  cpu_init(snes->cpu, snes, snes_cpuRead, snes_cpuWrite, snes_cpuIdle);
+  apu_init(snes->apu, snes, &mem->spc, &mem->dsp, mem->apuRam);
+  dma_init(snes->dma, snes);
+  ppu_init(snes->ppu, snes, mem->ppuVram);
+  cart_init(snes->cart, snes);
+  input_init(snes->input1, snes);
+  input_init(snes->input2, snes);
+  snes_mapReadPages(snes);
+  snes->movie = NULL;
+  snes->profiler = NULL;
+  snes->cdl = NULL;
   snes->palTiming = false;
+  snes->allocation = NULL;
+  snes->stateSize = 0;
   return snes;
 }
 
 void snes_free(Snes* snes) {
-  cpu_free(snes->cpu);
-  apu_free(snes->apu);
-  dma_free(snes->dma);
-  ppu_free(snes->ppu);
   cart_free(snes->cart);
-  input_free(snes->input1);
-  input_free(snes->input2);
-  free(snes);
+  if(snes->allocation != NULL) free(snes->allocation);
 }
 
 void snes_reset(Snes* snes, bool hard) {
@@ -58,7 +106,7 @@ void snes_reset(Snes* snes, bool hard) {
   input_reset(snes->input1);
   input_reset(snes->input2);
   cart_reset(snes->cart);
-  if(hard) memset(snes->ram, 0, sizeof(snes->ram));
+  if(hard) memset(snes->ram, 0, 0x20000);
   snes->ramAdr = 0;
   snes->hPos = 0;
   snes->vPos = 0;
@@ -85,6 +133,18 @@ void snes_reset(Snes* snes, bool hard) {
   snes->divideResult = 0x101;
   snes->fastMem = false;
   snes->openBus = 0;
+  snes_setDirtyPages(snes, true);
+}
+
+void snes_setDirtyPages(Snes* snes, bool dirty) {
+  // sets the dirty flags for all pages of wram, vram, cgram, oam, aram and cart ram
+  memset(snes->ramDirty, dirty, sizeof(snes->ramDirty));
+  memset(snes->ppu->vramDirty, dirty, sizeof(snes->ppu->vramDirty));
+  memset(snes->ppu->cgramDirty, dirty, sizeof(snes->ppu->cgramDirty));
+  memset(snes->ppu->oamDirty, dirty, sizeof(snes->ppu->oamDirty));
+  memset(snes->ppu->highOamDirty, dirty, sizeof(snes->ppu->highOamDirty));
+  memset(snes->apu->ramDirty, dirty, sizeof(snes->apu->ramDirty));
+  if(snes->cart->ram != NULL) memset(snes->cart->ramDirty, dirty, (snes->cart->ramSize + 0xff) >> 8);
 }
 
 void snes_handleState(Snes* snes, StateHandler* sh) {
@@ -101,7 +161,7 @@ void snes_handleState(Snes* snes, StateHandler* sh) {
   sh_handleInts(sh, &snes->ramAdr, &snes->frames, NULL);
   sh_handleLongLongs(sh, &snes->cycles, &snes->syncCycle, NULL);
   sh_handleDoubles(sh, &snes->apuCatchupCycles, NULL);
-  sh_handleByteArray(sh, snes->ram, 0x20000);
+  sh_handleDirtyByteArray(sh, snes->ram, 0x20000, snes->ramDirty);
   // components
   cpu_handleState(snes->cpu, sh);
   dma_handleState(snes->dma, sh);
@@ -131,8 +191,17 @@ void snes_runCycles(Snes* snes, int cycles) {
     // if we go past 536, add 40 cycles for dram refersh
     cycles += 40;
   }
-  for(int i = 0; i < cycles; i += 2) {
-    snes_runCycle(snes);
+  int steps = (cycles + 1) / 2;
+  if(snes_canRunFast(snes, steps)) {
+    snes_runCyclesFast(snes, steps);
+  } else {
+    for(int i = 0; i < steps; i++) {
+      snes_runCycle(snes);
+    }
+  }
+  // (if the cycle count went back, by a reset or loading a state, this samples right away and continues from there)
+  if(snes->profiler != NULL && snes->cycles - snes->profiler->lastSample >= snes->profiler->interval) {
+    profiler_sampleCpu(snes->profiler, snes->cycles);
   }
 }
 
@@ -150,17 +219,7 @@ void snes_syncCycles(Snes* snes, bool start, int syncCycles) {
 static void snes_runCycle(Snes* snes) {
   snes->apuCatchupCycles += (snes->palTiming ? apuCyclesPerMasterPal : apuCyclesPerMaster) * 2.0;
   snes->cycles += 2;
-  // check for h/v timer irq's
-  bool condition = (
-    (snes->vIrqEnabled || snes->hIrqEnabled) &&
-    (snes->vPos == snes->vTimer || !snes->vIrqEnabled) &&
-    (snes->hPos == snes->hTimer * 4 || !snes->hIrqEnabled)
-  );
-  if(!snes->irqCondition && condition) {
-    snes->inIrq = true;
-    cpu_setIrq(snes->cpu, true);
-  }
-  snes->irqCondition = condition;
+  snes_checkIrq(snes);
   // handle positional stuff
   if(snes->hPos == 0) {
     // end of hblank, do most vPos-tests
@@ -182,6 +241,7 @@ static void snes_runCycle(Snes* snes) {
       ppu_handleVblank(snes->ppu);
       snes->inVblank = true;
       snes->inNmi = true;
+      if(snes->movie != NULL) movie_handleFrame(snes->movie);
       if(snes->autoJoyRead) {
         // TODO: this starts a little after start of vblank
         snes->autoJoyTimer = 4224;
@@ -228,6 +288,44 @@ static void snes_runCycle(Snes* snes) {
   }
 }
 
+static bool snes_canRunFast(Snes* snes, int steps) {
+  // if none of the positions checked by snes_runCycle are in the span of steps, and it stays on the same line
+  int first = snes->hPos;
+  int last = first + (steps - 1) * 2;
+  if(steps <= 0 || last + 2 >= 1360) return false; // line end is 1360 at the earliest
+  if(first == 0 || (first <= 16 && last >= 16) || (first <= 512 && last >= 512) || (first <= 1104 && last >= 1104)) {
+    return false;
+  }
+  return !(snes->hIrqEnabled && first <= snes->hTimer * 4 && last >= snes->hTimer * 4);
+}
+
+static void snes_runCyclesFast(Snes* snes, int steps) {
+  // same as running snes_runCycle steps times, for a span checked by snes_canRunFast
+  // the irq condition can not change within it, and there are no positional events
+  double apuCycles = (snes->palTiming ? apuCyclesPerMasterPal : apuCyclesPerMaster) * 2.0;
+  double catchupCycles = snes->apuCatchupCycles;
+  for(int i = 0; i < steps; i++) catchupCycles += apuCycles; // one at a time, to round the same way
+  snes->apuCatchupCycles = catchupCycles;
+  snes->cycles += steps * 2;
+  snes_checkIrq(snes);
+  snes->autoJoyTimer = snes->autoJoyTimer > steps * 2 ? snes->autoJoyTimer - steps * 2 : 0;
+  snes->hPos += steps * 2;
+}
+
+static void snes_checkIrq(Snes* snes) {
+  // check for h/v timer irq's
+  bool condition = (
+    (snes->vIrqEnabled || snes->hIrqEnabled) &&
+    (snes->vPos == snes->vTimer || !snes->vIrqEnabled) &&
+    (snes->hPos == snes->hTimer * 4 || !snes->hIrqEnabled)
+  );
+  if(!snes->irqCondition && condition) {
+    snes->inIrq = true;
+    cpu_setIrq(snes->cpu, true);
+  }
+  snes->irqCondition = condition;
+}
+
 static void snes_catchupApu(Snes* snes) {
   int catchupCycles = (int) snes->apuCatchupCycles;
   int ranCycles = apu_runCycles(snes->apu, catchupCycles);
@@ -279,6 +377,7 @@ void snes_writeBBus(Snes* snes, uint8_t adr, uint8_t val) {
   }
   switch(adr) {
     case 0x80: {
+      snes->ramDirty[snes->ramAdr >> 8] = true;
       snes->ram[snes->ramAdr++] = val;
       snes->ramAdr &= 0x1ffff;
       break;
@@ -473,10 +572,12 @@ void snes_write(Snes* snes, uint32_t adr, uint8_t val) {
   adr &= 0xffff;
   if(bank == 0x7e || bank == 0x7f) {
     snes->ram[((bank & 1) << 16) | adr] = val; // ram
+    snes->ramDirty[((bank & 1) << 8) | (adr >> 8)] = true;
   }
   if(bank < 0x40 || (bank >= 0x80 && bank < 0xc0)) {
     if(adr < 0x2000) {
       snes->ram[adr] = val; // ram mirror
+      snes->ramDirty[adr >> 8] = true;
     }
     if(adr >= 0x2100 && adr < 0x2200) {
       snes_writeBBus(snes, adr & 0xff, val); // B-bus
@@ -510,7 +611,9 @@ static int snes_getAccessTime(Snes* snes, uint32_t adr) {
 }
 
 uint8_t snes_read(Snes* snes, uint32_t adr) {
-  uint8_t val = snes_rread(snes, adr);
+  // pages that read wram or rom are read directly, without decoding the address
+  const uint8_t* page = snes->readPages[(adr >> 12) & 0xfff];
+  uint8_t val = page != NULL ? page[adr & 0xfff] : snes_rread(snes, adr);
   snes->openBus = val;
   return val;
 }
@@ -526,6 +629,7 @@ uint8_t snes_cpuRead(void* mem, uint32_t adr) {
   int cycles = snes_getAccessTime(snes, adr);
   dma_handleDma(snes->dma, cycles);
   snes_runCycles(snes, cycles);
+  if(snes->cdl != NULL) snes_logCpuRead(snes, adr);
   return snes_read(snes, adr);
 }
 
@@ -537,6 +641,49 @@ void snes_cpuWrite(void* mem, uint32_t adr, uint8_t val) {
   snes_write(snes, adr, val);
 }
 
+void snes_mapReadPages(Snes* snes) {
+  // sets up the 4K pages of the cpu address space that only read wram or rom, other pages are NULL
+  // has to be redone when the rom is attached or the ram moves, writes do not need any updates
+  for(int i = 0; i < 0x1000; i++) {
+    uint8_t bank = i >> 4;
+    uint16_t adr = (i & 0xf) << 12;
+    snes->readPages[i] = NULL;
+    if(bank == 0x7e || bank == 0x7f) {
+      snes->readPages[i] = snes->ram + (((bank & 1) << 16) | adr); // ram
+      continue;
+    }
+    if((bank < 0x40 || (bank >= 0x80 && bank < 0xc0)) && adr < 0x8000) {
+      if(adr < 0x2000) snes->readPages[i] = snes->ram + adr; // ram mirror
+      continue; // other pages hold registers, expansion or cart ram
+    }
+    // rom pages are contiguous in the rom image, as mirroring is done in 4K pages
+    int offset = cart_getRomOffset(snes->cart, bank, adr);
+    if(offset >= 0) snes->readPages[i] = snes->cart->rom + offset;
+  }
+}
+
+void snes_logRead(Snes* snes, uint32_t adr, uint8_t flag) {
+  // marks the rom byte read at adr in the code/data log, if adr reads rom
+  if((adr >> 17) == 0x3f) return; // banks 7e-7f, ram
+  int offset = cart_getRomOffset(snes->cart, adr >> 16, adr & 0xffff);
+  if(offset >= 0 && offset < snes->cdl->romSize) snes->cdl->rom[offset] |= flag;
+}
+
+static void snes_logCpuRead(Snes* snes, uint32_t adr) {
+  // reads after the opcode and before the pc (in the same bank) are its operands,
+  // a read at the pc itself is a dummy read and is not logged
+  uint32_t pc = (snes->cpu->k << 16) | snes->cpu->pc;
+  uint32_t opcodeAdr = snes->cdl->cpuOpcodeAdr;
+  if(adr == pc) return;
+  uint8_t flag = cdlData;
+  if(adr == opcodeAdr) {
+    flag = cdlOpcode;
+  } else if((adr >> 16) == (opcodeAdr >> 16) && (uint16_t) (adr - opcodeAdr) < 4 && (uint16_t) (adr - opcodeAdr) < (uint16_t) (pc - opcodeAdr)) {
+    flag = cdlOperand;
+  }
+  snes_logRead(snes, adr, flag);
+}
+
 // debugging
 
 void snes_runCpuCycle(Snes* snes) {
@@ -13,6 +13,11 @@ typedef struct Snes Snes;
 #include "ppu.h"
 #include "cart.h"
 #include "input.h"
+#include "romimage.h"
+#include "movie.h"
+#include "trace.h"
+#include "profiler.h"
+#include "cdl.h"
 #include "statehandler.h"
 
 struct Snes {
@@ -25,9 +30,16 @@ struct Snes {
   // input
   Input* input1;
   Input* input2;
+  Movie* movie; // recording or playing movie, NULL if none
+  Profiler* profiler; // NULL if not profiling
+  Cdl* cdl; // NULL if not logging
+  void* allocation; // if allocated by snes_init instead of placed with snes_initInto
+  int stateSize; // size of a full savestate, 0 until determined for the loaded rom
   // ram
-  uint8_t ram[0x20000];
+  uint8_t* ram; // 128K, placed at the end of the snes memory
+  const uint8_t** readPages; // per 4K page of the cpu address space, set by snes_mapReadPages
   uint32_t ramAdr;
+  bool ramDirty[0x200]; // per 256-byte page, if written since the dirty pages were last cleared
   // frame timing
   uint16_t hPos;
   uint16_t vPos;
@@ -62,9 +74,12 @@ struct Snes {
 };
 
 Snes* snes_init(void);
+int snes_getMemorySize(void);
+Snes* snes_initInto(void* memory);
 void snes_free(Snes* snes);
 void snes_reset(Snes* snes, bool hard);
 void snes_handleState(Snes* snes, StateHandler* sh);
+void snes_setDirtyPages(Snes* snes, bool dirty);
 void snes_runFrame(Snes* snes);
 // used by dma, cpu
 void snes_runCycles(Snes* snes, int cycles);
@@ -76,22 +91,45 @@ void snes_write(Snes* snes, uint32_t adr, uint8_t val);
 void snes_cpuIdle(void* mem, bool waiting);
 uint8_t snes_cpuRead(void* mem, uint32_t adr);
 void snes_cpuWrite(void* mem, uint32_t adr, uint8_t val);
+void snes_logRead(Snes* snes, uint32_t adr, uint8_t flag);
+void snes_mapReadPages(Snes* snes);
 // debugging
 void snes_runCpuCycle(Snes* snes);
 void snes_runSpcCycle(Snes* snes);
 
 // snes_other.c functions:
 
-enum { pixelFormatXRGB = 0, pixelFormatRGBX = 1 };
+enum { pixelFormatXRGB = 0, pixelFormatRGBX = 1, pixelFormatRGB565 = 2, pixelFormatBGR555 = 3 };
 
 bool snes_loadRom(Snes* snes, const uint8_t* data, int length);
+RomImage* snes_createRom(const uint8_t* data, int length);
+RomImage* snes_openRom(const char* path);
+void snes_attachRom(Snes* snes, RomImage* rom);
+void snes_releaseRom(RomImage* rom);
 void snes_setButtonState(Snes* snes, int player, int button, bool pressed);
 void snes_setPixelFormat(Snes* snes, int pixelFormat);
-void snes_setPixels(Snes* snes, uint8_t* pixelData);
+void snes_setPixelBuffer(Snes* snes, uint8_t* pixelData, int pitch, bool allowNarrow);
+void snes_getPixelSize(Snes* snes, int* width, int* height);
+void snes_setRenderSkip(Snes* snes, bool skip);
+Snes* snes_clone(Snes* snes);
+void snes_copyInto(Snes* dest, Snes* src);
+void snes_runAhead(Snes* snes, int frames, uint8_t* stateData);
+int snes_getChangedLines(Snes* snes, int* firstLines, int* lineCounts, int maxRanges);
 void snes_setSamples(Snes* snes, int16_t* sampleData, int samplesPerFrame);
+int snes_getNativeSamples(Snes* snes, int16_t* sampleData, uint16_t* position);
 int snes_saveBattery(Snes* snes, uint8_t* data);
 bool snes_loadBattery(Snes* snes, uint8_t* data, int size);
 int snes_saveState(Snes* snes, uint8_t* data);
 bool snes_loadState(Snes* snes, uint8_t* data, int size);
+void snes_clearDirtyPages(Snes* snes);
+int snes_saveStateIncremental(Snes* snes, uint8_t* data);
+bool snes_loadStateIncremental(Snes* snes, uint8_t* data, int size);
+uint64_t snes_hashState(Snes* snes);
+bool snes_startTrace(Snes* snes, Trace* trace, bool cpu, bool spc);
+void snes_stopTrace(Snes* snes);
+void snes_startProfile(Snes* snes, Profiler* profiler);
+void snes_stopProfile(Snes* snes);
+void snes_startCdl(Snes* snes, Cdl* cdl);
+void snes_stopCdl(Snes* snes);
 
 #endif
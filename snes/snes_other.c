@@ -6,9 +6,18 @@
 #include <stdbool.h>
 
 #include "snes.h"
-#include "cart.h"
-#include "ppu.h"
+#include "cpu.h"
+#include "apu.h"
+#include "spc.h"
 #include "dsp.h"
+#include "dma.h"
+#include "ppu.h"
+#include "cart.h"
+#include "input.h"
+#include "movie.h"
+#include "trace.h"
+#include "profiler.h"
+#include "cdl.h"
 #include "statehandler.h"
 
 static const int stateVersion = 2;
@@ -46,8 +55,73 @@ typedef struct CartHeader {
 } CartHeader;
 
 static void readHeader(const uint8_t* data, int length, int location, CartHeader* header);
+static bool snes_findHeader(const uint8_t** romData, int* romLength, CartHeader* header);
+static int snes_getExpandedSize(int length);
+static void snes_setupRom(RomImage* rom, CartHeader* header);
+static int snes_saveStateFile(Snes* snes, uint8_t* data, bool incremental);
+static bool snes_loadStateFile(Snes* snes, uint8_t* data, int size, bool incremental);
+static void snes_handleStateFile(Snes* snes, StateHandler* sh, uint32_t length);
+static void snes_attachProfiler(Snes* snes, Profiler* profiler);
+static void snes_attachCdl(Snes* snes, Cdl* cdl);
 
 bool snes_loadRom(Snes* snes, const uint8_t* data, int length) {
+  RomImage* rom = snes_createRom(data, length);
+  if(rom == NULL) return false;
+  snes_attachRom(snes, rom);
+  snes_releaseRom(rom);
+  return true;
+}
+
+RomImage* snes_createRom(const uint8_t* data, int length) {
+  // creates a rom image from a copy of data, which can be attached to multiple instances
+  // returns NULL if the rom can't be loaded
+  CartHeader header;
+  if(!snes_findHeader(&data, &length, &header)) return NULL;
+  RomImage* rom = rom_initFromData(data, length, length);
+  snes_setupRom(rom, &header);
+  return rom;
+}
+
+RomImage* snes_openRom(const char* path) {
+  // creates a rom image backed by the mapped file
+  // returns NULL if the file can't be opened or the rom can't be loaded
+  RomImage* rom = rom_initFromFile(path);
+  if(rom == NULL) {
+    printf("Failed to load rom: can't open file '%s'\n", path);
+    return NULL;
+  }
+  const uint8_t* data = rom->data;
+  int length = rom->size;
+  CartHeader header;
+  if(!snes_findHeader(&data, &length, &header)) {
+    rom_release(rom);
+    return NULL;
+  }
+  // skip the copier header within the mapping
+  rom->data = data;
+  rom->size = length;
+  snes_setupRom(rom, &header);
+  return rom;
+}
+
+void snes_attachRom(Snes* snes, RomImage* rom) {
+  // loads the rom (keeping a reference to it) and resets
+  cart_load(snes->cart, rom->type, rom, rom->ramSize);
+  snes_mapReadPages(snes);
+  snes->stateSize = 0; // depends on the cart
+  snes_reset(snes, true); // reset after loading
+  snes->palTiming = rom->pal; // set region
+}
+
+void snes_releaseRom(RomImage* rom) {
+  // the image is freed once no longer attached to any instance
+  rom_release(rom);
+}
+
+static bool snes_findHeader(const uint8_t** romData, int* romLength, CartHeader* header) {
+  // finds the most likely header, moves romData and romLength past a copier header
+  const uint8_t* data = *romData;
+  int length = *romLength;
   // if smaller than smallest possible, don't load
   if(length < 0x8000) {
     printf("Failed to load rom: rom to small (%d bytes)\n", length);
@@ -76,15 +150,20 @@ bool snes_loadRom(Snes* snes, const uint8_t* data, int length) {
   }
   if(used & 1) {
     // odd-numbered ones are for headered roms
-    data += 0x200; // move pointer past header
-    length -= 0x200; // and subtract from size
+    *romData += 0x200; // move pointer past header
+    *romLength -= 0x200; // and subtract from size
   }
   // check if we can load it
   if(headers[used].cartType > 3) {
     printf("Failed to load rom: unsupported type (%d)\n", headers[used].cartType);
     return false;
   }
-  // expand to a power of 2
+  *header = headers[used];
+  return true;
+}
+
+static int snes_getExpandedSize(int length) {
+  // size when expanded to a power of 2
   int newLength = 0x8000;
   while(true) {
     if(length <= newLength) {
@@ -92,33 +171,38 @@ bool snes_loadRom(Snes* snes, const uint8_t* data, int length) {
     }
     newLength *= 2;
   }
-  uint8_t* newData = malloc(newLength);
-  memcpy(newData, data, length);
-  int test = 1;
-  while(length != newLength) {
-    if(length & test) {
-      memcpy(newData + length, newData + length - test, test);
-      length += test;
+  return newLength;
+}
+
+static void snes_setupRom(RomImage* rom, CartHeader* header) {
+  // mirrors up to a power of 2, sets the header values
+  int length = rom->size;
+  int newLength = snes_getExpandedSize(length);
+  if(length & 0xfff) {
+    // not a multiple of 4K, pad by copying the end instead
+    rom_setData(rom, rom->data, length, newLength);
+    int test = 1;
+    while(length & 0xfff) {
+      if(length & test) {
+        memcpy(rom->allocation + length, rom->allocation + length - test, test);
+        length += test;
+      }
+      test *= 2;
     }
-    test *= 2;
+    rom->size = length;
   }
-  // load it
+  rom_setMirroredSize(rom, newLength);
+  rom->type = header->cartType;
+  rom->pal = header->pal;
+  rom->ramSize = header->chips > 0 ? header->ramSize : 0;
   const char* typeNames[4] = {"(none)", "LoROM", "HiROM", "ExHiROM"};
-  printf("Loaded %s rom (%s)\n", typeNames[headers[used].cartType], headers[used].pal ? "PAL" : "NTSC");
-  printf("\"%s\"\n", headers[used].name);
-  int bankSize = used >= 2 ? 0x10000 : 0x8000; // 0, 1: LoROM, else HiROM
+  printf("Loaded %s rom (%s)\n", typeNames[header->cartType], header->pal ? "PAL" : "NTSC");
+  printf("\"%s\"\n", header->name);
+  int bankSize = header->cartType == 1 ? 0x8000 : 0x10000; // 1: LoROM, else HiROM
   printf(
     "%s banks: %d, ramsize: %d\n",
-    bankSize == 0x8000 ? "32K" : "64K", newLength / bankSize, headers[used].chips > 0 ? headers[used].ramSize : 0
-  );
-  cart_load(
-    snes->cart, headers[used].cartType,
-    newData, newLength, headers[used].chips > 0 ? headers[used].ramSize : 0
+    bankSize == 0x8000 ? "32K" : "64K", newLength / bankSize, rom->ramSize
   );
-  snes_reset(snes, true); // reset after loading
-  snes->palTiming = headers[used].pal; // set region
-  free(newData);
-  return true;
 }
 
 void snes_setButtonState(Snes* snes, int player, int button, bool pressed) {
@@ -140,12 +224,181 @@ void snes_setButtonState(Snes* snes, int player, int button, bool pressed) {
 
 void snes_setPixelFormat(Snes* snes, int pixelFormat) {
   // pixelFormatXRGB, pixelFormatRGBX (default: pixelFormatRGBX)
-  ppu_setPixelOutputFormat(snes->ppu, (pixelFormat) ? ppu_pixelOutputFormatBGRX : ppu_pixelOutputFormatXBGR);
+  // pixelFormatRGB565, pixelFormatBGR555 (16 bit, native endian)
+  switch(pixelFormat) {
+    case pixelFormatXRGB: ppu_setPixelOutputFormat(snes->ppu, ppu_pixelOutputFormatXBGR); break;
+    case pixelFormatRGB565: ppu_setPixelOutputFormat(snes->ppu, ppu_pixelOutputFormatRGB565); break;
+    case pixelFormatBGR555: ppu_setPixelOutputFormat(snes->ppu, ppu_pixelOutputFormatBGR555); break;
+    default: ppu_setPixelOutputFormat(snes->ppu, ppu_pixelOutputFormatBGRX); break;
+  }
+}
+
+void snes_setPixelBuffer(Snes* snes, uint8_t* pixelData, int pitch, bool allowNarrow) {
+  // size is at least pitch * 478 (h), pitch at least 4 (rgba) * 512 (w), or 2 * 512 for 16 bit formats
+  // lines are rendered directly into it while running frames, pass NULL to stop output
+  // if allowNarrow is set, frames without hires lines are output 256 wide
+  ppu_setPixelOutput(snes->ppu, pixelData, pitch, allowNarrow);
+}
+
+void snes_getPixelSize(Snes* snes, int* width, int* height) {
+  // gets the size of the last frame in the pixel buffer
+  // width is 256 or 512, height is 224 or 239 (448 or 478 if interlaced)
+  ppu_getOutputSize(snes->ppu, width, height);
+}
+
+void snes_setRenderSkip(Snes* snes, bool skip) {
+  // if set, frames are run without rendering, the pixel buffer keeps the last rendered frame
+  // emulated state is identical to running with rendering
+  ppu_setRenderSkip(snes->ppu, skip);
 }
 
-void snes_setPixels(Snes* snes, uint8_t* pixelData) {
-  // size is 4 (rgba) * 512 (w) * 480 (h)
-  ppu_putPixels(snes->ppu, pixelData);
+Snes* snes_clone(Snes* snes) {
+  // creates a new instance in the same state, sharing the rom
+  // the clone has no pixel output set
+  Snes* clone = snes_init();
+  snes_copyInto(clone, snes);
+  return clone;
+}
+
+void snes_copyInto(Snes* dest, Snes* src) {
+  // copies the full state of src into dest (created by snes_init or snes_initInto), sharing the rom
+  // dest keeps its own pixel output settings, movie, trace, profiler and code/data log
+  Cpu* cpu = dest->cpu;
+  Apu* apu = dest->apu;
+  Ppu* ppu = dest->ppu;
+  Dma* dma = dest->dma;
+  Cart* cart = dest->cart;
+  Input* input1 = dest->input1;
+  Input* input2 = dest->input2;
+  uint8_t* ram = dest->ram;
+  const uint8_t** readPages = dest->readPages;
+  void* allocation = dest->allocation;
+  Movie* movie = dest->movie;
+  Profiler* profiler = dest->profiler;
+  Cdl* cdl = dest->cdl;
+  CallStack* cpuCallStack = dest->cpu->callStack;
+  CallStack* spcCallStack = dest->apu->spc->callStack;
+#ifdef LAKESNES_TRACE
+  Trace* cpuTrace = dest->cpu->trace;
+  Trace* spcTrace = dest->apu->spc->trace;
+#endif
+  *dest = *src;
+  dest->allocation = allocation;
+  dest->movie = movie;
+  dest->profiler = profiler;
+  dest->cdl = cdl;
+  dest->ram = ram;
+  dest->readPages = readPages;
+  memcpy(dest->ram, src->ram, 0x20000);
+  dest->cpu = cpu;
+  dest->apu = apu;
+  dest->ppu = ppu;
+  dest->dma = dma;
+  dest->cart = cart;
+  dest->input1 = input1;
+  dest->input2 = input2;
+  *dest->cpu = *src->cpu;
+  dest->cpu->mem = dest;
+  dest->cpu->callStack = cpuCallStack;
+  dest->cpu->cdl = cdl;
+  Spc* spc = dest->apu->spc;
+  Dsp* dsp = dest->apu->dsp;
+  uint8_t* apuRam = dest->apu->ram;
+  *dest->apu = *src->apu;
+  dest->apu->snes = dest;
+  dest->apu->spc = spc;
+  dest->apu->dsp = dsp;
+  dest->apu->ram = apuRam;
+  memcpy(dest->apu->ram, src->apu->ram, 0x10000);
+  *spc = *src->apu->spc;
+  spc->mem = dest->apu;
+  spc->callStack = spcCallStack;
+  spc->cdl = cdl;
+#ifdef LAKESNES_TRACE
+  dest->cpu->trace = cpuTrace;
+  spc->trace = spcTrace;
+#endif
+  *dsp = *src->apu->dsp;
+  dsp->apu = dest->apu;
+  uint8_t* pixelOutput = dest->ppu->pixelOutput;
+  int pixelOutputPitch = dest->ppu->pixelOutputPitch;
+  uint8_t pixelOutputFormat = dest->ppu->pixelOutputFormat;
+  bool pixelOutputNarrow = dest->ppu->pixelOutputNarrow;
+  bool renderSkip = dest->ppu->renderSkip;
+  uint16_t* vram = dest->ppu->vram;
+  *dest->ppu = *src->ppu;
+  dest->ppu->snes = dest;
+  dest->ppu->vram = vram;
+  memcpy(dest->ppu->vram, src->ppu->vram, 0x10000);
+  dest->ppu->pixelOutput = pixelOutput;
+  dest->ppu->pixelOutputPitch = pixelOutputPitch;
+  dest->ppu->pixelOutputFormat = pixelOutputFormat;
+  dest->ppu->pixelOutputNarrow = pixelOutputNarrow;
+  dest->ppu->renderSkip = renderSkip;
+  dest->ppu->outputInvalid = true;
+  *dest->dma = *src->dma;
+  dest->dma->snes = dest;
+  *dest->input1 = *src->input1;
+  dest->input1->snes = dest;
+  *dest->input2 = *src->input2;
+  dest->input2->snes = dest;
+  cart_copyInto(dest->cart, src->cart);
+  snes_mapReadPages(dest);
+}
+
+void snes_runAhead(Snes* snes, int frames, uint8_t* stateData) {
+  // runs frames further (rendering only the last one) and then goes back to the state before it
+  // meant for after running (and getting the samples of) the actual frame, the pixel buffer then shows the frame ahead
+  // samples of the frames ahead are not used, stateData needs room for a savestate
+  // a recording or playing movie is not advanced by the frames ahead, and they are not traced, profiled or logged
+  bool renderSkip = snes->ppu->renderSkip;
+  Movie* movie = snes->movie;
+  Profiler* profiler = snes->profiler;
+  Cdl* cdl = snes->cdl;
+  int size = snes_saveState(snes, stateData);
+  snes_stopProfile(snes);
+  snes_stopCdl(snes);
+  snes->movie = NULL;
+#ifdef LAKESNES_TRACE
+  Trace* cpuTrace = snes->cpu->trace;
+  Trace* spcTrace = snes->apu->spc->trace;
+  snes->cpu->trace = NULL;
+  snes->apu->spc->trace = NULL;
+#endif
+  for(int i = 0; i < frames; i++) {
+    ppu_setRenderSkip(snes->ppu, i < frames - 1);
+    snes_runFrame(snes);
+  }
+#ifdef LAKESNES_TRACE
+  snes->cpu->trace = cpuTrace;
+  snes->apu->spc->trace = spcTrace;
+#endif
+  snes->movie = movie;
+  ppu_setRenderSkip(snes->ppu, renderSkip);
+  snes_loadState(snes, stateData, size);
+  if(profiler != NULL) snes_attachProfiler(snes, profiler);
+  if(cdl != NULL) snes_attachCdl(snes, cdl);
+}
+
+int snes_getChangedLines(Snes* snes, int* firstLines, int* lineCounts, int maxRanges) {
+  // gets the ranges of lines in the pixel buffer that changed during the last rendered frame
+  // returns the amount of ranges, 0 if the frame is identical to the one before it
+  // if there are more than maxRanges ranges, the last ones are merged, with maxRanges 0 (no room) it returns 0
+  if(maxRanges <= 0) return 0;
+  int width, height;
+  ppu_getOutputSize(snes->ppu, &width, &height);
+  int ranges = 0;
+  for(int i = 0; i < height; i++) {
+    if(!ppu_getLineChanged(snes->ppu, i)) continue;
+    if(ranges > 0 && (firstLines[ranges - 1] + lineCounts[ranges - 1] == i || ranges == maxRanges)) {
+      lineCounts[ranges - 1] = i - firstLines[ranges - 1] + 1;
+    } else {
+      firstLines[ranges] = i;
+      lineCounts[ranges] = 1;
+      ranges++;
+    }
+  }
+  return ranges;
 }
 
 void snes_setSamples(Snes* snes, int16_t* sampleData, int samplesPerFrame) {
@@ -154,6 +407,13 @@ void snes_setSamples(Snes* snes, int16_t* sampleData, int samplesPerFrame) {
   dsp_getSamples(snes->apu->dsp, sampleData, samplesPerFrame);
 }
 
+int snes_getNativeSamples(Snes* snes, int16_t* sampleData, uint16_t* position) {
+  // size is 2 (int16) * 2 (stereo) * 0x400
+  // sets the samples as produced by the dsp (at 32040 Hz) since position, which is updated, and returns the amount
+  // position starts as 0 after reset, about 534 (641 for PAL) samples are produced per frame
+  return dsp_getNewSamples(snes->apu->dsp, sampleData, position);
+}
+
 int snes_saveBattery(Snes* snes, uint8_t* data) {
   int size = 0;
   cart_handleBattery(snes->cart, true, data, &size);
@@ -165,37 +425,132 @@ bool snes_loadBattery(Snes* snes, uint8_t* data, int size) {
 }
 
 int snes_saveState(Snes* snes, uint8_t* data) {
-  StateHandler* sh = sh_init(true, NULL, 0);
-  uint32_t id = 0x4653534c; // 'LSSF' LakeSnes State File
-  uint32_t version = stateVersion;
-  sh_handleInts(sh, &id, &version, &version, NULL); // second version to be overridden by length
-  cart_handleTypeState(snes->cart, sh);
-  // save data
-  snes_handleState(snes, sh);
-  // store
-  sh_placeInt(sh, 8, sh->offset);
-  if(data != NULL) memcpy(data, sh->data, sh->offset);
-  int size = sh->offset;
-  sh_free(sh);
-  return size;
+  // data needs room for the size returned by snes_saveState(snes, NULL), which stays the same while a rom is loaded
+  return snes_saveStateFile(snes, data, false);
 }
 
 bool snes_loadState(Snes* snes, uint8_t* data, int size) {
-  StateHandler* sh = sh_init(false, data, size);
+  // marks all pages as dirty, call snes_clearDirtyPages after loading if the state is used as base
+  return snes_loadStateFile(snes, data, size, false);
+}
+
+void snes_clearDirtyPages(Snes* snes) {
+  // sets the current state as base for incremental states
+  snes_setDirtyPages(snes, false);
+}
+
+int snes_saveStateIncremental(Snes* snes, uint8_t* data) {
+  // saves a state with only the memory pages written since the dirty pages were cleared
+  // the size depends on the amount of dirty pages, snes_saveStateIncremental(snes, NULL) returns it
+  return snes_saveStateFile(snes, data, true);
+}
+
+bool snes_loadStateIncremental(Snes* snes, uint8_t* data, int size) {
+  // loads a state saved by snes_saveStateIncremental, on top of the base it was saved against
+  // (load the base with snes_loadState, and call snes_clearDirtyPages, before loading)
+  return snes_loadStateFile(snes, data, size, true);
+}
+
+uint64_t snes_hashState(Snes* snes) {
+  // hashes everything a state holds (registers, ram, vram, cgram, oam, aram, dsp, dma, sram), without saving a state
+  // two instances (or builds) that emulate identically have the same hash after each frame
+  StateHandler sh;
+  sh_initHash(&sh);
+  snes_handleState(snes, &sh);
+  return sh_getHash(&sh);
+}
+
+bool snes_startTrace(Snes* snes, Trace* trace, bool cpu, bool spc) {
+  // clears the trace and adds a record for each opcode the cpu and/or spc executes from now on
+  // returns false if tracing is not compiled in (LAKESNES_TRACE not defined)
+#ifdef LAKESNES_TRACE
+  trace_clear(trace);
+  trace->cpuCycles = &snes->cycles;
+  trace->spcCycles = &snes->apu->cycles;
+  snes->cpu->trace = cpu ? trace : NULL;
+  snes->apu->spc->trace = spc ? trace : NULL;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void snes_stopTrace(Snes* snes) {
+#ifdef LAKESNES_TRACE
+  snes->cpu->trace = NULL;
+  snes->apu->spc->trace = NULL;
+#endif
+}
+
+void snes_startProfile(Snes* snes, Profiler* profiler) {
+  // clears the profiler and samples from now on, every profiler->interval master cycles (for the spc, the same time in apu cycles)
+  // the call stacks start out empty, so calls made before starting are attributed to main
+  profiler_clear(profiler);
+  profiler->lastSample = snes->cycles;
+  profiler->lastSpcSample = snes->apu->cycles;
+  snes_attachProfiler(snes, profiler);
+}
+
+void snes_stopProfile(Snes* snes) {
+  snes->profiler = NULL;
+  snes->cpu->callStack = NULL;
+  snes->apu->spc->callStack = NULL;
+}
+
+void snes_startCdl(Snes* snes, Cdl* cdl) {
+  // clears the log (sized for the loaded rom) and logs rom and aram accesses from now on
+  // a saved log can then be merged in with cdl_load
+  cdl_clear(cdl, snes->cart->romImage != NULL ? snes->cart->romImage->size : 0);
+  snes_attachCdl(snes, cdl);
+}
+
+void snes_stopCdl(Snes* snes) {
+  snes->cdl = NULL;
+  snes->cpu->cdl = NULL;
+  snes->apu->spc->cdl = NULL;
+}
+
+static int snes_saveStateFile(Snes* snes, uint8_t* data, bool incremental) {
+  // determine size first, without writing anything (a full state only once per rom, as its size stays the same)
+  StateHandler sh;
+  uint32_t size = snes->stateSize;
+  if(incremental || size == 0) {
+    sh_init(&sh, true, incremental, NULL, 0);
+    snes_handleStateFile(snes, &sh, 0);
+    size = sh.offset;
+    if(!incremental) snes->stateSize = size;
+  }
+  if(data == NULL) return size;
+  // save data directly into the buffer
+  sh_init(&sh, true, incremental, data, size);
+  snes_handleStateFile(snes, &sh, size);
+  return size;
+}
+
+static bool snes_loadStateFile(Snes* snes, uint8_t* data, int size, bool incremental) {
+  StateHandler sh;
+  sh_init(&sh, false, incremental, data, size);
   uint32_t id = 0, version = 0, length = 0;
-  sh_handleInts(sh, &id, &version, &length, NULL);
-  bool cartMatch = cart_handleTypeState(snes->cart, sh);
-  if(id != 0x4653534c || version != stateVersion || length != size || !cartMatch) {
-    sh_free(sh);
+  sh_handleInts(&sh, &id, &version, &length, NULL);
+  bool cartMatch = cart_handleTypeState(snes->cart, &sh);
+  uint32_t wantedId = incremental ? 0x4953534c : 0x4653534c;
+  if(id != wantedId || version != stateVersion || length != size || !cartMatch) {
     return false;
   }
   // load data
-  snes_handleState(snes, sh);
-  // finish
-  sh_free(sh);
+  snes_handleState(snes, &sh);
   return true;
 }
 
+static void snes_handleStateFile(Snes* snes, StateHandler* sh, uint32_t length) {
+  // header, then the state
+  uint32_t id = sh->incremental ? 0x4953534c : 0x4653534c; // 'LSSF' LakeSnes State File, 'LSSI' for incremental
+  uint32_t version = stateVersion;
+  sh_handleInts(sh, &id, &version, &length, NULL);
+  cart_handleTypeState(snes->cart, sh);
+  snes_handleState(snes, sh);
+}
+
 static void readHeader(const uint8_t* data, int length, int location, CartHeader* header) {
   // read name, TODO: non-ASCII names?
   for(int i = 0; i < 21; i++) {
@@ -289,3 +644,15 @@ static void readHeader(const uint8_t* data, int length, int location, CartHeader
   }
   header->score = score;
 }
+
+static void snes_attachProfiler(Snes* snes, Profiler* profiler) {
+  snes->profiler = profiler;
+  snes->cpu->callStack = &profiler->cpuStack;
+  snes->apu->spc->callStack = &profiler->spcStack;
+}
+
+static void snes_attachCdl(Snes* snes, Cdl* cdl) {
+  snes->cdl = cdl;
+  snes->cpu->cdl = cdl;
+  snes->apu->spc->cdl = cdl;
+}
@@ -14,9 +14,12 @@ static void spc_idle(Spc* spc);
 static void spc_idleWait(Spc* spc);
 static uint8_t spc_readOpcode(Spc* spc);
 static uint16_t spc_readOpcodeWord(Spc* spc);
-static uint8_t spc_getFlags(Spc* spc);
 static void spc_setFlags(Spc* spc, uint8_t value);
 static void spc_setZN(Spc* spc, uint8_t value);
+static void spc_setZNWord(Spc* spc, uint16_t value);
+static void spc_setZNFlags(Spc* spc, bool z, bool n);
+static bool spc_getZ(Spc* spc);
+static bool spc_getN(Spc* spc);
 static void spc_doBranch(Spc* spc, uint8_t value, bool check);
 static uint8_t spc_pullByte(Spc* spc);
 static void spc_pushByte(Spc* spc, uint8_t value);
@@ -25,20 +28,24 @@ static void spc_pushWord(Spc* spc, uint16_t value);
 static uint16_t spc_readWord(Spc* spc, uint16_t adrl, uint16_t adrh);
 static void spc_writeWord(Spc* spc, uint16_t adrl, uint16_t adrh, uint16_t value);
 static void spc_doOpcode(Spc* spc, uint8_t opcode);
+static void spc_trackCall(Spc* spc, uint8_t opcode);
+#ifdef LAKESNES_TRACE
+static void spc_traceOpcode(Spc* spc);
+#endif
 
 // addressing modes and opcode functions not declared, only used after defintions
 
-Spc* spc_init(void* mem, SpcReadHandler read, SpcWriteHandler write, SpcIdleHandler idle) {
-  Spc* spc = malloc(sizeof(Spc));
+void spc_init(Spc* spc, void* mem, SpcReadHandler read, SpcWriteHandler write, SpcIdleHandler idle) {
   spc->mem = mem;
   spc->read = read;
   spc->write = write;
   spc->idle = idle;
-  return spc;
-}
-
-void spc_free(Spc* spc) {
-  free(spc);
+  spc->callStack = NULL;
+  spc->cdl = NULL;
+#ifdef LAKESNES_TRACE
+  spc->trace = NULL;
+  spc->traceRecord = NULL;
+#endif
 }
 
 void spc_reset(Spc* spc, bool hard) {
@@ -49,9 +56,8 @@ void spc_reset(Spc* spc, bool hard) {
     spc->sp = 0;
     spc->pc = 0;
     spc->c = false;
-    spc->z = false;
+    spc_setZNFlags(spc, false, false);
     spc->v = false;
-    spc->n = false;
     spc->i = false;
     spc->h = false;
     spc->p = false;
@@ -62,10 +68,14 @@ void spc_reset(Spc* spc, bool hard) {
 }
 
 void spc_handleState(Spc* spc, StateHandler* sh) {
+  // z and n are stored as bools
+  bool z = spc_getZ(spc);
+  bool n = spc_getN(spc);
   sh_handleBools(sh,
-    &spc->c, &spc->z, &spc->v, &spc->n, &spc->i, &spc->h, &spc->p, &spc->b, &spc->stopped,
+    &spc->c, &z, &spc->v, &n, &spc->i, &spc->h, &spc->p, &spc->b, &spc->stopped,
     &spc->resetWanted, NULL
   );
+  if(!sh->saving) spc_setZNFlags(spc, z, n);
   sh_handleBytes(sh, &spc->a, &spc->x, &spc->y, &spc->sp, NULL);
   sh_handleWords(sh, &spc->pc, NULL);
 }
@@ -82,14 +92,23 @@ void spc_runOpcode(Spc* spc) {
     spc_idle(spc);
     spc->i = false;
     spc->pc = spc_readWord(spc, 0xfffe, 0xffff);
+    if(spc->callStack != NULL) spc->callStack->depth = 0;
     return;
   }
   if(spc->stopped) {
     spc_idleWait(spc);
     return;
   }
+#ifdef LAKESNES_TRACE
+  if(spc->trace != NULL) spc_traceOpcode(spc);
+#endif
+  if(spc->cdl != NULL) spc->cdl->spcOpcodeAdr = spc->pc;
   uint8_t opcode = spc_readOpcode(spc);
   spc_doOpcode(spc, opcode);
+  if(spc->callStack != NULL) spc_trackCall(spc, opcode);
+#ifdef LAKESNES_TRACE
+  spc->traceRecord = NULL;
+#endif
 }
 
 static uint8_t spc_read(Spc* spc, uint16_t adr) {
@@ -109,7 +128,11 @@ static void spc_idleWait(Spc* spc) {
 }
 
 static uint8_t spc_readOpcode(Spc* spc) {
-  return spc_read(spc, spc->pc++);
+  uint8_t val = spc_read(spc, spc->pc++);
+#ifdef LAKESNES_TRACE
+  if(spc->traceRecord != NULL && spc->traceRecord->length < 4) spc->traceRecord->bytes[spc->traceRecord->length++] = val;
+#endif
+  return val;
 }
 
 static uint16_t spc_readOpcodeWord(Spc* spc) {
@@ -117,32 +140,48 @@ static uint16_t spc_readOpcodeWord(Spc* spc) {
   return low | (spc_readOpcode(spc) << 8);
 }
 
-static uint8_t spc_getFlags(Spc* spc) {
-  uint8_t val = spc->n << 7;
+uint8_t spc_getFlags(Spc* spc) {
+  uint8_t val = spc_getN(spc) << 7;
   val |= spc->v << 6;
   val |= spc->p << 5;
   val |= spc->b << 4;
   val |= spc->h << 3;
   val |= spc->i << 2;
-  val |= spc->z << 1;
+  val |= spc_getZ(spc) << 1;
   val |= spc->c;
   return val;
 }
 
 static void spc_setFlags(Spc* spc, uint8_t val) {
-  spc->n = val & 0x80;
+  spc_setZNFlags(spc, val & 2, val & 0x80);
   spc->v = val & 0x40;
   spc->p = val & 0x20;
   spc->b = val & 0x10;
   spc->h = val & 8;
   spc->i = val & 4;
-  spc->z = val & 2;
   spc->c = val & 1;
 }
 
 static void spc_setZN(Spc* spc, uint8_t value) {
-  spc->z = value == 0;
-  spc->n = value & 0x80;
+  // moved up, so that z and n are at the same place as for word results
+  spc->zn = value << 8;
+}
+
+static void spc_setZNWord(Spc* spc, uint16_t value) {
+  spc->zn = value;
+}
+
+static void spc_setZNFlags(Spc* spc, bool z, bool n) {
+  // sets z and n separately, bit 16 sets n on its own
+  spc->zn = (n << 16) | !z;
+}
+
+static bool spc_getZ(Spc* spc) {
+  return (spc->zn & 0xffff) == 0;
+}
+
+static bool spc_getN(Spc* spc) {
+  return spc->zn & 0x18000;
 }
 
 static void spc_doBranch(Spc* spc, uint8_t value, bool check) {
@@ -184,6 +223,35 @@ static void spc_writeWord(Spc* spc, uint16_t adrl, uint16_t adrh, uint16_t value
   spc_write(spc, adrh, value >> 8);
 }
 
+static void spc_trackCall(Spc* spc, uint8_t opcode) {
+  // keeps the shadow call stack for profiling, after executing the opcode
+  if(opcode == 0x0f || opcode == 0x3f || opcode == 0x4f || (opcode & 0xf) == 1) {
+    // brk, call, pcall, tcall
+    profiler_call(spc->callStack, spc->pc, spc->sp);
+  } else if(opcode == 0x6f || opcode == 0x7f) {
+    // ret, reti
+    profiler_return(spc->callStack, spc->sp);
+  }
+}
+
+#ifdef LAKESNES_TRACE
+static void spc_traceOpcode(Spc* spc) {
+  // starts a record for the opcode about to be fetched, spc_readOpcode adds the bytes
+  TraceRecord* record = trace_add(spc->trace, traceSpc);
+  record->pc = spc->pc;
+  record->bank = 0;
+  record->flags = spc_getFlags(spc);
+  record->db = 0;
+  record->e = 0;
+  record->a = spc->a;
+  record->x = spc->x;
+  record->y = spc->y;
+  record->sp = spc->sp;
+  record->dp = 0;
+  spc->traceRecord = record;
+}
+#endif
+
 // adressing modes
 
 static uint16_t spc_adrDp(Spc* spc) {
@@ -602,7 +670,7 @@ static void spc_doOpcode(Spc* spc, uint8_t opcode) {
       break;
     }
     case 0x10: { // bpl rel
-      spc_doBranch(spc, spc_readOpcode(spc), !spc->n);
+      spc_doBranch(spc, spc_readOpcode(spc), !spc_getN(spc));
       break;
     }
     case 0x14: { // or  dpx
@@ -640,8 +708,7 @@ static void spc_doOpcode(Spc* spc, uint8_t opcode) {
       spc_write(spc, low, value & 0xff);
       value += spc_read(spc, high) << 8;
       spc_write(spc, high, value >> 8);
-      spc->z = value == 0;
-      spc->n = value & 0x8000;
+      spc_setZNWord(spc, value);
       break;
     }
     case 0x1b: { // asl dpx
@@ -735,7 +802,7 @@ static void spc_doOpcode(Spc* spc, uint8_t opcode) {
       break;
     }
     case 0x30: { // bmi rel
-      spc_doBranch(spc, spc_readOpcode(spc), spc->n);
+      spc_doBranch(spc, spc_readOpcode(spc), spc_getN(spc));
       break;
     }
     case 0x34: { // and dpx
@@ -773,8 +840,7 @@ static void spc_doOpcode(Spc* spc, uint8_t opcode) {
       spc_write(spc, low, value & 0xff);
       value += spc_read(spc, high) << 8;
       spc_write(spc, high, value >> 8);
-      spc->z = value == 0;
-      spc->n = value & 0x8000;
+      spc_setZNWord(spc, value);
       break;
     }
     case 0x3b: { // rol dpx
@@ -915,8 +981,7 @@ static void spc_doOpcode(Spc* spc, uint8_t opcode) {
       uint16_t ya = spc->a | (spc->y << 8);
       int result = ya + value + 1;
       spc->c = result > 0xffff;
-      spc->z = (result & 0xffff) == 0;
-      spc->n = result & 0x8000;
+      spc_setZNWord(spc, result);
       break;
     }
     case 0x5b: { // lsr dpx
@@ -1051,8 +1116,7 @@ static void spc_doOpcode(Spc* spc, uint8_t opcode) {
       spc->v = (ya & 0x8000) == (value & 0x8000) && (value & 0x8000) != (result & 0x8000);
       spc->h = ((ya & 0xfff) + (value & 0xfff)) > 0xfff;
       spc->c = result > 0xffff;
-      spc->z = (result & 0xffff) == 0;
-      spc->n = result & 0x8000;
+      spc_setZNWord(spc, result);
       spc->a = result & 0xff;
       spc->y = result >> 8;
       break;
@@ -1192,8 +1256,7 @@ static void spc_doOpcode(Spc* spc, uint8_t opcode) {
       spc->v = (ya & 0x8000) == (value & 0x8000) && (value & 0x8000) != (result & 0x8000);
       spc->h = ((ya & 0xfff) + (value & 0xfff) + 1) > 0xfff;
       spc->c = result > 0xffff;
-      spc->z = (result & 0xffff) == 0;
-      spc->n = result & 0x8000;
+      spc_setZNWord(spc, result);
       spc->a = result & 0xff;
       spc->y = result >> 8;
       break;
@@ -1345,8 +1408,7 @@ static void spc_doOpcode(Spc* spc, uint8_t opcode) {
       uint16_t val = vall | (spc_read(spc, high) << 8);
       spc->a = val & 0xff;
       spc->y = val >> 8;
-      spc->z = val == 0;
-      spc->n = val & 0x8000;
+      spc_setZNWord(spc, val);
       break;
     }
     case 0xbb: { // inc dpx
@@ -1450,7 +1512,7 @@ static void spc_doOpcode(Spc* spc, uint8_t opcode) {
       break;
     }
     case 0xd0: { // bne rel
-      spc_doBranch(spc, spc_readOpcode(spc), !spc->z);
+      spc_doBranch(spc, spc_readOpcode(spc), !spc_getZ(spc));
       break;
     }
     case 0xd4: { // movs dpx
@@ -1585,7 +1647,7 @@ static void spc_doOpcode(Spc* spc, uint8_t opcode) {
       break;
     }
     case 0xf0: { // beq rel
-      spc_doBranch(spc, spc_readOpcode(spc), spc->z);
+      spc_doBranch(spc, spc_readOpcode(spc), spc_getZ(spc));
       break;
     }
     case 0xf4: { // mov dpx
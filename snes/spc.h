@@ -6,6 +6,11 @@
 #include <stdbool.h>
 
 #include "statehandler.h"
+#include "profiler.h"
+#include "cdl.h"
+#ifdef LAKESNES_TRACE
+#include "trace.h"
+#endif
 
 typedef uint8_t (*SpcReadHandler)(void* mem, uint16_t adr);
 typedef void (*SpcWriteHandler)(void* mem, uint16_t adr, uint8_t val);
@@ -26,10 +31,9 @@ struct Spc {
   uint8_t sp;
   uint16_t pc;
   // flags
+  uint32_t zn; // result z and n are taken from: z if bits 0-15 are 0, n if bit 15 or 16 is set
   bool c;
-  bool z;
   bool v;
-  bool n;
   bool i;
   bool h;
   bool p;
@@ -38,12 +42,21 @@ struct Spc {
   bool stopped;
   // reset
   bool resetWanted;
+  // profiling
+  CallStack* callStack; // shadow call stack, NULL if not profiling
+  // code/data logging
+  Cdl* cdl; // gets the address of each opcode, NULL if not logging
+#ifdef LAKESNES_TRACE
+  // tracing, NULL if not tracing
+  Trace* trace;
+  TraceRecord* traceRecord; // record of the current opcode, gets the fetched bytes
+#endif
 };
 
-Spc* spc_init(void* mem, SpcReadHandler read, SpcWriteHandler write, SpcIdleHandler idle);
-void spc_free(Spc* spc);
+void spc_init(Spc* spc, void* mem, SpcReadHandler read, SpcWriteHandler write, SpcIdleHandler idle);
 void spc_reset(Spc* spc, bool hard);
 void spc_handleState(Spc* spc, StateHandler* sh);
 void spc_runOpcode(Spc* spc);
+uint8_t spc_getFlags(Spc* spc);
 
 #endif
@@ -10,38 +10,76 @@
 
 static void sh_writeByte(StateHandler* sh, uint8_t val);
 static uint8_t sh_readByte(StateHandler* sh);
+static void sh_handlePages(StateHandler* sh, uint8_t* data, int size, int elementSize, bool* dirty);
+static void sh_hashBlock(StateHandler* sh, const uint8_t* data);
+static void sh_hashData(StateHandler* sh, const uint8_t* data, int size);
+static uint64_t sh_readLong(const uint8_t* data);
 
-StateHandler* sh_init(bool saving, const uint8_t* data, int size) {
-  StateHandler* sh = malloc(sizeof(StateHandler));
+// primes as used by xxHash64
+static const uint64_t prime1 = 0x9e3779b185ebca87ull;
+static const uint64_t prime2 = 0xc2b2ae3d27d4eb4full;
+static const uint64_t prime3 = 0x165667b19e3779f9ull;
+static const uint64_t prime4 = 0x85ebca77c2b2ae63ull;
+
+void sh_init(StateHandler* sh, bool saving, bool incremental, const uint8_t* data, int size) {
+  // the data is used in place, nothing is allocated
+  // when saving with data NULL, nothing is written and offset ends up as the size of the state
   sh->saving = saving;
+  sh->incremental = incremental;
   sh->offset = 0;
-  if(!saving) {
-    sh->data = malloc(size);
-    memcpy(sh->data, data, size);
-    sh->allocSize = size;
-  } else {
-    sh->data = malloc(1024);
-    sh->allocSize = 1024;
-  }
-  return sh;
+  sh->data = (uint8_t*) data;
+  sh->size = data == NULL ? 0 : size;
+  sh->hashing = false;
+}
+
+void sh_initHash(StateHandler* sh) {
+  // saves by hashing everything that would be written, without writing anything
+  // the hash (xxHash64-like, not the same values) is obtained with sh_getHash
+  sh_init(sh, true, false, NULL, 0);
+  sh->hashing = true;
+  sh->lanes[0] = prime1 + prime2;
+  sh->lanes[1] = prime2;
+  sh->lanes[2] = 0;
+  sh->lanes[3] = -prime1;
+  sh->pendingSize = 0;
 }
 
-void sh_free(StateHandler* sh) {
-  free(sh->data);
-  free(sh);
+uint64_t sh_getHash(StateHandler* sh) {
+  // combines the lanes and hashes the remaining bytes (as a zero-padded block), the handler can't be used after
+  static const int rotations[4] = {1, 7, 12, 18};
+  uint64_t hash = 0;
+  for(int i = 0; i < 4; i++) {
+    hash += (sh->lanes[i] << rotations[i]) | (sh->lanes[i] >> (64 - rotations[i]));
+  }
+  if(sh->pendingSize > 0) {
+    memset(sh->pending + sh->pendingSize, 0, 32 - sh->pendingSize);
+    sh_hashBlock(sh, sh->pending);
+    for(int i = 0; i < 4; i++) hash = (hash ^ sh->lanes[i]) * prime1 + prime4;
+  }
+  hash += sh->offset;
+  hash ^= hash >> 33;
+  hash *= prime2;
+  hash ^= hash >> 29;
+  hash *= prime3;
+  hash ^= hash >> 32;
+  return hash;
 }
 
 static void sh_writeByte(StateHandler* sh, uint8_t val) {
-  if(sh->offset >= sh->allocSize) {
-    // realloc
-    sh->data = realloc(sh->data, sh->allocSize * 2);
-    sh->allocSize *= 2;
+  if(sh->hashing) {
+    sh->pending[sh->pendingSize++] = val;
+    if(sh->pendingSize == 32) {
+      sh_hashBlock(sh, sh->pending);
+      sh->pendingSize = 0;
+    }
+  } else if(sh->data != NULL && sh->offset < sh->size) {
+    sh->data[sh->offset] = val;
   }
-  sh->data[sh->offset++] = val;
+  sh->offset++;
 }
 
 static uint8_t sh_readByte(StateHandler* sh) {
-  if(sh->offset >= sh->allocSize) {
+  if(sh->offset >= sh->size) {
     // reading above data (should never happen)
     return 0;
   }
@@ -228,6 +266,25 @@ void sh_handleDoubles(StateHandler* sh, ...) {
 }
 
 void sh_handleByteArray(StateHandler* sh, uint8_t* data, int size) {
+  if(sh->hashing) {
+    sh_hashData(sh, data, size);
+    sh->offset += size;
+    return;
+  }
+  if(sh->offset + size <= sh->size) {
+    // fits, copy as a whole
+    if(sh->saving) {
+      memcpy(sh->data + sh->offset, data, size);
+    } else {
+      memcpy(data, sh->data + sh->offset, size);
+    }
+    sh->offset += size;
+    return;
+  }
+  if(sh->saving && sh->data == NULL) {
+    sh->offset += size;
+    return;
+  }
   for(int i = 0; i < size; i++) {
     if(sh->saving) {
       sh_writeByte(sh, data[i]);
@@ -238,6 +295,10 @@ void sh_handleByteArray(StateHandler* sh, uint8_t* data, int size) {
 }
 
 void sh_handleWordArray(StateHandler* sh, uint16_t* data, int size) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  // words are stored little endian, so on little endian hosts the array can be copied as is
+  sh_handleByteArray(sh, (uint8_t*) data, size * 2);
+#else
   for(int i = 0; i < size; i++) {
     if(sh->saving) {
       sh_writeByte(sh, data[i] & 0xff);
@@ -247,12 +308,91 @@ void sh_handleWordArray(StateHandler* sh, uint16_t* data, int size) {
       data[i] |= sh_readByte(sh) << 8;
     }
   }
+#endif
+}
+
+void sh_handleDirtyByteArray(StateHandler* sh, uint8_t* data, int size, bool* dirty) {
+  // dirty has an entry per 256-byte page, set when it was written to
+  // loading marks the loaded pages as dirty
+  sh_handlePages(sh, data, size, 1, dirty);
+}
+
+void sh_handleDirtyWordArray(StateHandler* sh, uint16_t* data, int size, bool* dirty) {
+  // as sh_handleDirtyByteArray, with pages of 128 words
+  sh_handlePages(sh, (uint8_t*) data, size * 2, 2, dirty);
+}
+
+static void sh_handlePages(StateHandler* sh, uint8_t* data, int size, int elementSize, bool* dirty) {
+  int pages = (size + 0xff) >> 8;
+  if(!sh->incremental) {
+    if(elementSize == 2) {
+      sh_handleWordArray(sh, (uint16_t*) data, size / 2);
+    } else {
+      sh_handleByteArray(sh, data, size);
+    }
+    if(!sh->saving) memset(dirty, true, pages);
+    return;
+  }
+  // incremental: a flag per page, followed by the page if it is dirty
+  for(int i = 0; i < pages; i++) {
+    bool pageDirty = dirty[i];
+    sh_handleBools(sh, &pageDirty, NULL);
+    if(!pageDirty) continue;
+    int pageSize = size - (i << 8) < 0x100 ? size - (i << 8) : 0x100;
+    if(elementSize == 2) {
+      sh_handleWordArray(sh, (uint16_t*) (data + (i << 8)), pageSize / 2);
+    } else {
+      sh_handleByteArray(sh, data + (i << 8), pageSize);
+    }
+    dirty[i] = true;
+  }
+}
+
+static void sh_hashBlock(StateHandler* sh, const uint8_t* data) {
+  // 4 independent lanes of 8 bytes, which the compiler can keep in flight (or vectorize) together
+  for(int i = 0; i < 4; i++) {
+    uint64_t lane = sh->lanes[i] + sh_readLong(data + i * 8) * prime2;
+    sh->lanes[i] = ((lane << 31) | (lane >> 33)) * prime1;
+  }
+}
+
+static void sh_hashData(StateHandler* sh, const uint8_t* data, int size) {
+  // fill up the pending block first, then hash full blocks directly from data
+  while(sh->pendingSize > 0 && size > 0) {
+    sh_writeByte(sh, *data++);
+    sh->offset--; // counted by the caller
+    size--;
+  }
+  if(size == 0) return; // (possibly still pending)
+  // lanes kept in locals, as data could alias them
+  uint64_t lane0 = sh->lanes[0], lane1 = sh->lanes[1], lane2 = sh->lanes[2], lane3 = sh->lanes[3];
+  while(size >= 32) {
+    lane0 += sh_readLong(data) * prime2;
+    lane1 += sh_readLong(data + 8) * prime2;
+    lane2 += sh_readLong(data + 16) * prime2;
+    lane3 += sh_readLong(data + 24) * prime2;
+    lane0 = ((lane0 << 31) | (lane0 >> 33)) * prime1;
+    lane1 = ((lane1 << 31) | (lane1 >> 33)) * prime1;
+    lane2 = ((lane2 << 31) | (lane2 >> 33)) * prime1;
+    lane3 = ((lane3 << 31) | (lane3 >> 33)) * prime1;
+    data += 32;
+    size -= 32;
+  }
+  sh->lanes[0] = lane0;
+  sh->lanes[1] = lane1;
+  sh->lanes[2] = lane2;
+  sh->lanes[3] = lane3;
+  memcpy(sh->pending, data, size);
+  sh->pendingSize = size;
 }
 
-void sh_placeInt(StateHandler* sh, int location, uint32_t value) {
-  while(sh->offset < location + 4) sh_writeByte(sh, 0);
-  sh->data[location] = value & 0xff;
-  sh->data[location + 1] = (value >> 8) & 0xff;
-  sh->data[location + 2] = (value >> 16) & 0xff;
-  sh->data[location + 3] = (value >> 24) & 0xff;
+static uint64_t sh_readLong(const uint8_t* data) {
+  // little endian, regardless of host
+  uint64_t val = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(&val, data, 8);
+#else
+  for(int i = 0; i < 8; i++) val |= (uint64_t) data[i] << (i * 8);
+#endif
+  return val;
 }
@@ -8,12 +8,19 @@
 typedef struct StateHandler {
   bool saving;
   int offset;
-  uint8_t* data;
-  int allocSize;
+  uint8_t* data; // NULL when saving to only determine the size
+  int size;
+  bool incremental; // if arrays with dirty pages only handle the dirty pages
+  // hashing, instead of writing
+  bool hashing;
+  uint64_t lanes[4];
+  uint8_t pending[32]; // bytes not yet hashed, until there is a full block
+  int pendingSize;
 } StateHandler;
 
-StateHandler* sh_init(bool saving, const uint8_t* data, int size);
-void sh_free(StateHandler* sh);
+void sh_init(StateHandler* sh, bool saving, bool incremental, const uint8_t* data, int size);
+void sh_initHash(StateHandler* sh);
+uint64_t sh_getHash(StateHandler* sh);
 
 void sh_handleBools(StateHandler* sh, ...);
 void sh_handleBytes(StateHandler* sh, ...);
@@ -27,6 +34,7 @@ void sh_handleFloats(StateHandler* sh, ...);
 void sh_handleDoubles(StateHandler* sh, ...);
 void sh_handleByteArray(StateHandler* sh, uint8_t* data, int size);
 void sh_handleWordArray(StateHandler* sh, uint16_t* data, int size);
-void sh_placeInt(StateHandler* sh, int location, uint32_t value);
+void sh_handleDirtyByteArray(StateHandler* sh, uint8_t* data, int size, bool* dirty);
+void sh_handleDirtyWordArray(StateHandler* sh, uint16_t* data, int size, bool* dirty);
 
 #endif
@@ -0,0 +1,114 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "trace.h"
+#include "statehandler.h"
+
+static const int traceVersion = 1;
+/*
+1: initial version
+*/
+
+static void trace_handleFile(Trace* trace, StateHandler* sh);
+static void trace_handleRecord(TraceRecord* record, StateHandler* sh);
+
+Trace* trace_init(int capacity) {
+  Trace* trace = malloc(sizeof(Trace));
+  uint32_t size = 1;
+  while(size < capacity) size *= 2;
+  trace->records = malloc(size * sizeof(TraceRecord));
+  trace->mask = size - 1;
+  trace->count = 0;
+  trace->cpuCycles = NULL;
+  trace->spcCycles = NULL;
+  return trace;
+}
+
+void trace_free(Trace* trace) {
+  free(trace->records);
+  free(trace);
+}
+
+void trace_clear(Trace* trace) {
+  trace->count = 0;
+}
+
+TraceRecord* trace_add(Trace* trace, int processor) {
+  // called by the cpu and spc before fetching an opcode, they fill in the rest of the record
+  // the record stays valid until capacity more records are added
+  TraceRecord* record = &trace->records[trace->count++ & trace->mask];
+  record->cycle = processor == traceCpu ? *trace->cpuCycles : *trace->spcCycles;
+  record->processor = processor;
+  memset(record->bytes, 0, 4);
+  record->length = 0;
+  return record;
+}
+
+int trace_getRecords(Trace* trace, TraceRecord* records, int maxRecords) {
+  // copies the last maxRecords (at most) records, oldest first, returns the amount copied
+  uint64_t count = trace->count < trace->mask + 1 ? trace->count : trace->mask + 1;
+  if(count > maxRecords) count = maxRecords;
+  for(uint64_t i = trace->count - count; i < trace->count; i++) {
+    *records++ = trace->records[i & trace->mask];
+  }
+  return count;
+}
+
+int trace_save(Trace* trace, uint8_t* data) {
+  // returns the size, data can be NULL to only get the size
+  StateHandler sh;
+  sh_init(&sh, true, false, NULL, 0);
+  trace_handleFile(trace, &sh);
+  if(data == NULL) return sh.offset;
+  int size = sh.offset;
+  sh_init(&sh, true, false, data, size);
+  trace_handleFile(trace, &sh);
+  return size;
+}
+
+bool trace_readHeader(const uint8_t* data, int size, uint32_t* count, uint64_t* total) {
+  // reads the header (traceHeaderSize bytes) of a trace file, the records follow it
+  // returns false if it is not a trace file, count is the amount of records, total the amount traced
+  StateHandler sh;
+  sh_init(&sh, false, false, data, size);
+  uint32_t id = 0, version = 0;
+  sh_handleInts(&sh, &id, &version, count, NULL);
+  sh_handleLongLongs(&sh, total, NULL);
+  return size >= traceHeaderSize && id == 0x5254534c && version == traceVersion;
+}
+
+void trace_readRecords(const uint8_t* data, TraceRecord* records, int count) {
+  // reads count records (traceRecordSize bytes each) from a trace file
+  StateHandler sh;
+  sh_init(&sh, false, false, data, count * traceRecordSize);
+  for(int i = 0; i < count; i++) trace_handleRecord(&records[i], &sh);
+}
+
+static void trace_handleFile(Trace* trace, StateHandler* sh) {
+  // header: id, version, record count, total amount of records traced (including the ones no longer kept)
+  // then the records, oldest first
+  uint32_t id = 0x5254534c; // 'LSTR' LakeSnes TRace
+  uint32_t version = traceVersion;
+  uint64_t total = trace->count;
+  uint64_t start = total < trace->mask + 1 ? 0 : total - (trace->mask + 1);
+  uint32_t count = total - start;
+  sh_handleInts(sh, &id, &version, &count, NULL);
+  sh_handleLongLongs(sh, &total, NULL);
+  if(sh->data == NULL) {
+    // only getting the size
+    sh->offset += count * traceRecordSize;
+    return;
+  }
+  for(uint64_t i = start; i < total; i++) trace_handleRecord(&trace->records[i & trace->mask], sh);
+}
+
+static void trace_handleRecord(TraceRecord* record, StateHandler* sh) {
+  sh_handleLongLongs(sh, &record->cycle, NULL);
+  sh_handleBytes(sh, &record->processor, &record->bank, &record->length, &record->flags, &record->db, &record->e, NULL);
+  sh_handleByteArray(sh, record->bytes, 4);
+  sh_handleWords(sh, &record->pc, &record->a, &record->x, &record->y, &record->sp, &record->dp, NULL);
+}
@@ -0,0 +1,50 @@
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// tracing is only compiled in with LAKESNES_TRACE defined, otherwise the cpu and spc have no tracing overhead at all
+
+enum { traceCpu = 0, traceSpc = 1 };
+// sizes in trace files
+enum { traceHeaderSize = 20, traceRecordSize = 30 };
+
+typedef struct TraceRecord {
+  uint64_t cycle; // master cycle for the cpu, spc cycle for the spc, at the start of the opcode
+  uint16_t pc;
+  uint8_t bank; // k for the cpu, 0 for the spc
+  uint8_t processor; // traceCpu or traceSpc
+  uint8_t bytes[4]; // opcode and operand bytes, as fetched
+  uint8_t length; // amount of bytes in bytes
+  uint8_t flags; // p
+  uint8_t db; // 0 for the spc
+  uint8_t e; // emulation mode, 0 for the spc
+  uint16_t a;
+  uint16_t x;
+  uint16_t y;
+  uint16_t sp;
+  uint16_t dp; // 0 for the spc
+} TraceRecord;
+
+typedef struct Trace {
+  TraceRecord* records; // ring buffer
+  uint32_t mask; // capacity - 1, the capacity is a power of 2
+  uint64_t count; // records added since started, only the last capacity ones are kept
+  // set by snes_startTrace
+  const uint64_t* cpuCycles;
+  const uint32_t* spcCycles;
+} Trace;
+
+Trace* trace_init(int capacity); // rounded up to a power of 2
+void trace_free(Trace* trace);
+void trace_clear(Trace* trace);
+TraceRecord* trace_add(Trace* trace, int processor);
+int trace_getRecords(Trace* trace, TraceRecord* records, int maxRecords);
+int trace_save(Trace* trace, uint8_t* data);
+// for reading trace files
+bool trace_readHeader(const uint8_t* data, int size, uint32_t* count, uint64_t* total);
+void trace_readRecords(const uint8_t* data, TraceRecord* records, int count);
+
+#endif
@@ -0,0 +1,306 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+
+#include "trace.h"
+#include "tracing.h"
+
+// offline trace tool: reads a trace file (as saved with trace_save) in chunks, so it does not need to fit in memory
+// usage: lakesnes_trace [-j threads] [-n top] [-pal] <command> <trace file>
+// commands:
+// dis: disassembles every record to stdout, chunks are decoded and disassembled in parallel and written in order
+// hot: the most executed addresses, per processor
+// calls: the most called subroutines (jsr/jsl for the cpu, call/pcall/tcall for the spc) and the most used call sites
+// frames: opcodes executed per frame, per processor
+// frames are derived from the cycle of each record (counted from the last reset), so they are approximate
+// the callee of a call is the next opcode of the same processor, an interrupt right after a call is counted as callee
+
+enum { chunkRecords = 0x10000, lineSize = 100 };
+
+typedef struct CountMap {
+  // open addressing hash map from key to count, keys are stored + 1 so that 0 marks an empty slot
+  uint64_t* keys;
+  uint64_t* counts;
+  uint32_t mask;
+  uint32_t used;
+} CountMap;
+
+typedef struct Chunk {
+  pthread_t thread;
+  uint8_t* data; // raw records
+  TraceRecord* records;
+  int count;
+  bool disassemble;
+  char* text; // disassembly, if disassembling
+  int textSize;
+} Chunk;
+
+typedef struct Stats {
+  // per processor (traceCpu, traceSpc)
+  CountMap hot[2]; // by address (bank << 16 | pc)
+  CountMap callees[2]; // by address called
+  CountMap calls[2]; // by caller << 24 | callee
+  bool callPending[2];
+  uint32_t caller[2];
+  double cyclesPerFrame[2];
+  uint64_t* frameCounts[2];
+  int frameCapacity;
+  int frames;
+} Stats;
+
+static void* runChunk(void* data);
+static void addStats(Stats* stats, const TraceRecord* records, int count);
+static bool isCall(int processor, uint8_t opcode);
+static void printTop(CountMap* map, int top, int processor, bool edges);
+static void map_init(CountMap* map);
+static void map_free(CountMap* map);
+static void map_add(CountMap* map, uint64_t key);
+static int compareCounts(const void* a, const void* b);
+
+int main(int argc, char** argv) {
+  int threads = 4;
+  int top = 20;
+  bool pal = false;
+  const char* command = NULL;
+  const char* tracePath = NULL;
+  for(int i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      top = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-pal") == 0) {
+      pal = true;
+    } else if(command == NULL) {
+      command = argv[i];
+    } else {
+      tracePath = argv[i];
+    }
+  }
+  bool disassemble = command != NULL && strcmp(command, "dis") == 0;
+  bool known = disassemble || (command != NULL && (
+    strcmp(command, "hot") == 0 || strcmp(command, "calls") == 0 || strcmp(command, "frames") == 0
+  ));
+  if(!known || tracePath == NULL || threads < 1 || top < 1) {
+    printf("Usage: %s [-j threads] [-n top] [-pal] <dis|hot|calls|frames> <trace file>\n", argv[0]);
+    return 1;
+  }
+  FILE* f = fopen(tracePath, "rb");
+  uint8_t header[traceHeaderSize];
+  uint32_t count = 0;
+  uint64_t total = 0;
+  if(f == NULL || fread(header, traceHeaderSize, 1, f) != 1 || !trace_readHeader(header, traceHeaderSize, &count, &total)) {
+    printf("Failed to read trace file '%s'\n", tracePath);
+    if(f != NULL) fclose(f);
+    return 1;
+  }
+  Chunk* chunks = malloc(threads * sizeof(Chunk));
+  for(int i = 0; i < threads; i++) {
+    chunks[i].data = malloc(chunkRecords * traceRecordSize);
+    chunks[i].records = malloc(chunkRecords * sizeof(TraceRecord));
+    chunks[i].disassemble = disassemble;
+    chunks[i].text = disassemble ? malloc(chunkRecords * lineSize) : NULL;
+  }
+  Stats stats = {};
+  for(int i = 0; i < 2; i++) {
+    map_init(&stats.hot[i]);
+    map_init(&stats.callees[i]);
+    map_init(&stats.calls[i]);
+  }
+  // master cycles for the cpu, spc cycles for the spc
+  stats.cyclesPerFrame[traceCpu] = pal ? 1364 * 312 : 1364 * 262;
+  stats.cyclesPerFrame[traceSpc] = 32040 * 32 / (pal ? 50.0 : 60.0);
+  // read as many chunks as there are threads, handle them in parallel, then use the results in order
+  uint32_t left = count;
+  while(left > 0) {
+    int used = 0;
+    for(; used < threads && left > 0; used++) {
+      Chunk* chunk = &chunks[used];
+      chunk->count = left < chunkRecords ? left : chunkRecords;
+      if(fread(chunk->data, traceRecordSize, chunk->count, f) != chunk->count) {
+        printf("Failed to read trace file '%s', it is truncated\n", tracePath);
+        left = 0;
+        break;
+      }
+      left -= chunk->count;
+      pthread_create(&chunk->thread, NULL, runChunk, chunk);
+    }
+    for(int i = 0; i < used; i++) {
+      pthread_join(chunks[i].thread, NULL);
+      if(disassemble) {
+        fwrite(chunks[i].text, chunks[i].textSize, 1, stdout);
+      } else {
+        addStats(&stats, chunks[i].records, chunks[i].count);
+      }
+    }
+  }
+  fclose(f);
+  if(!disassemble) {
+    printf("# %u records (of %llu traced)\n", count, (unsigned long long) total);
+    for(int i = 0; i < 2; i++) {
+      const char* name = i == traceCpu ? "CPU" : "SPC";
+      if(strcmp(command, "hot") == 0) {
+        printf("# %s hot addresses: address count\n", name);
+        printTop(&stats.hot[i], top, i, false);
+      } else if(strcmp(command, "calls") == 0) {
+        printf("# %s called addresses: address count\n", name);
+        printTop(&stats.callees[i], top, i, false);
+        printf("# %s calls: caller callee count\n", name);
+        printTop(&stats.calls[i], top, i, true);
+      }
+    }
+    if(strcmp(command, "frames") == 0) {
+      printf("# frame cpu spc\n");
+      for(int i = 0; i < stats.frames; i++) {
+        uint64_t cpuCount = stats.frameCounts[traceCpu] != NULL ? stats.frameCounts[traceCpu][i] : 0;
+        uint64_t spcCount = stats.frameCounts[traceSpc] != NULL ? stats.frameCounts[traceSpc][i] : 0;
+        if(cpuCount + spcCount == 0) continue;
+        printf("%d %llu %llu\n", i, (unsigned long long) cpuCount, (unsigned long long) spcCount);
+      }
+    }
+  }
+  // clean up
+  for(int i = 0; i < 2; i++) {
+    map_free(&stats.hot[i]);
+    map_free(&stats.callees[i]);
+    map_free(&stats.calls[i]);
+    free(stats.frameCounts[i]);
+  }
+  for(int i = 0; i < threads; i++) {
+    free(chunks[i].data);
+    free(chunks[i].records);
+    free(chunks[i].text);
+  }
+  free(chunks);
+  return 0;
+}
+
+static void* runChunk(void* data) {
+  Chunk* chunk = data;
+  trace_readRecords(chunk->data, chunk->records, chunk->count);
+  if(!chunk->disassemble) return NULL;
+  int offset = 0;
+  for(int i = 0; i < chunk->count; i++) {
+    getTraceRecordLine(&chunk->records[i], chunk->text + offset);
+    offset += strlen(chunk->text + offset);
+    chunk->text[offset++] = '\n';
+  }
+  chunk->textSize = offset;
+  return NULL;
+}
+
+static void addStats(Stats* stats, const TraceRecord* records, int count) {
+  // records have to be added in order, calls can span chunks
+  for(int i = 0; i < count; i++) {
+    const TraceRecord* record = &records[i];
+    int p = record->processor & 1;
+    uint32_t adr = (record->bank << 16) | record->pc;
+    map_add(&stats->hot[p], adr);
+    if(stats->callPending[p]) {
+      stats->callPending[p] = false;
+      map_add(&stats->callees[p], adr);
+      map_add(&stats->calls[p], ((uint64_t) stats->caller[p] << 24) | adr);
+    }
+    if(record->length > 0 && isCall(p, record->bytes[0])) {
+      stats->callPending[p] = true;
+      stats->caller[p] = adr;
+    }
+    int frame = (int) (record->cycle / stats->cyclesPerFrame[p]);
+    if(frame >= stats->frameCapacity) {
+      int capacity = stats->frameCapacity == 0 ? 1024 : stats->frameCapacity;
+      while(capacity <= frame) capacity *= 2;
+      for(int j = 0; j < 2; j++) {
+        stats->frameCounts[j] = realloc(stats->frameCounts[j], capacity * sizeof(uint64_t));
+        memset(stats->frameCounts[j] + stats->frameCapacity, 0, (capacity - stats->frameCapacity) * sizeof(uint64_t));
+      }
+      stats->frameCapacity = capacity;
+    }
+    stats->frameCounts[p][frame]++;
+    if(frame >= stats->frames) stats->frames = frame + 1;
+  }
+}
+
+static bool isCall(int processor, uint8_t opcode) {
+  if(processor == traceCpu) {
+    return opcode == 0x20 || opcode == 0x22 || opcode == 0xfc; // jsr, jsl, jsr (abs,x)
+  }
+  return opcode == 0x3f || opcode == 0x4f || (opcode & 0xf) == 1; // call, pcall, tcall
+}
+
+static void printTop(CountMap* map, int top, int processor, bool edges) {
+  // collects the used entries as key, count pairs and sorts them by count
+  uint64_t* entries = malloc(map->used * 2 * sizeof(uint64_t));
+  int used = 0;
+  for(uint32_t i = 0; i <= map->mask; i++) {
+    if(map->keys[i] == 0) continue;
+    entries[used * 2] = map->keys[i] - 1;
+    entries[used * 2 + 1] = map->counts[i];
+    used++;
+  }
+  qsort(entries, used, 2 * sizeof(uint64_t), compareCounts);
+  for(int i = 0; i < used && i < top; i++) {
+    uint64_t key = entries[i * 2];
+    unsigned long long count = entries[i * 2 + 1];
+    if(processor == traceCpu && edges) {
+      printf("%02x:%04x %02x:%04x %llu\n", (int) (key >> 40), (int) (key >> 24) & 0xffff, (int) (key >> 16) & 0xff, (int) key & 0xffff, count);
+    } else if(processor == traceCpu) {
+      printf("%02x:%04x %llu\n", (int) (key >> 16), (int) key & 0xffff, count);
+    } else if(edges) {
+      printf("%04x %04x %llu\n", (int) (key >> 24) & 0xffff, (int) key & 0xffff, count);
+    } else {
+      printf("%04x %llu\n", (int) key, count);
+    }
+  }
+  free(entries);
+}
+
+static void map_init(CountMap* map) {
+  map->mask = 0xfff;
+  map->used = 0;
+  map->keys = calloc(map->mask + 1, sizeof(uint64_t));
+  map->counts = calloc(map->mask + 1, sizeof(uint64_t));
+}
+
+static void map_free(CountMap* map) {
+  free(map->keys);
+  free(map->counts);
+}
+
+static void map_add(CountMap* map, uint64_t key) {
+  key++;
+  uint32_t index = (uint32_t) ((key * 0x9e3779b97f4a7c15ull) >> 32) & map->mask;
+  while(map->keys[index] != 0 && map->keys[index] != key) index = (index + 1) & map->mask;
+  if(map->keys[index] == key) {
+    map->counts[index]++;
+    return;
+  }
+  map->keys[index] = key;
+  map->counts[index] = 1;
+  map->used++;
+  if(map->used * 2 <= map->mask) return;
+  // over half full, rehash into double the size
+  CountMap old = *map;
+  map->mask = old.mask * 2 + 1;
+  map->keys = calloc(map->mask + 1, sizeof(uint64_t));
+  map->counts = calloc(map->mask + 1, sizeof(uint64_t));
+  for(uint32_t i = 0; i <= old.mask; i++) {
+    if(old.keys[i] == 0) continue;
+    index = (uint32_t) ((old.keys[i] * 0x9e3779b97f4a7c15ull) >> 32) & map->mask;
+    while(map->keys[index] != 0) index = (index + 1) & map->mask;
+    map->keys[index] = old.keys[i];
+    map->counts[index] = old.counts[i];
+  }
+  map_free(&old);
+}
+
+static int compareCounts(const void* a, const void* b) {
+  // descending by count, then ascending by key
+  const uint64_t* entryA = a;
+  const uint64_t* entryB = b;
+  if(entryA[1] != entryB[1]) return entryA[1] < entryB[1] ? 1 : -1;
+  return entryA[0] < entryB[0] ? -1 : (entryA[0] > entryB[0] ? 1 : 0);
+}
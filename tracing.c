@@ -8,6 +8,7 @@
 #include "tracing.h"
 #include "snes.h"
 #include "apu.h"
+#include "trace.h"
 
 // name for each opcode, to be filled in with sprintf (length = 14 (13+\0))
 static const char* opcodeNames[256] = {
@@ -91,6 +92,8 @@ static const int opcodeTypeSpc[256] = {
 
 static void getDisassemblyCpu(Snes* snes, char* line);
 static void getDisassemblySpc(Snes* snes, char* line);
+static void disassembleCpu(const uint8_t* bytes, uint16_t pc, bool mf, bool xf, char* line);
+static void disassembleSpc(const uint8_t* bytes, uint16_t pc, char* line);
 
 void getProcessorStateCpu(Snes* snes, char* line) {
   // 0        1         2         3         4         5         6         7         8
@@ -102,8 +105,8 @@ void getProcessorStateCpu(Snes* snes, char* line) {
     line, "CPU %02x:%04x %s A:%04x X:%04x Y:%04x SP:%04x DP:%04x DB:%02x %c %c%c%c%c%c%c%c%c",
     snes->cpu->k, snes->cpu->pc, disLine, snes->cpu->a, snes->cpu->x, snes->cpu->y,
     snes->cpu->sp, snes->cpu->dp, snes->cpu->db, snes->cpu->e ? 'E' : 'e',
-    snes->cpu->n ? 'N' : 'n', snes->cpu->v ? 'V' : 'v', snes->cpu->mf ? 'M' : 'm', snes->cpu->xf ? 'X' : 'x',
-    snes->cpu->d ? 'D' : 'd', snes->cpu->i ? 'I' : 'i', snes->cpu->z ? 'Z' : 'z', snes->cpu->c ? 'C' : 'c'
+    cpu_getFlags(snes->cpu) & 0x80 ? 'N' : 'n', snes->cpu->v ? 'V' : 'v', snes->cpu->mf ? 'M' : 'm', snes->cpu->xf ? 'X' : 'x',
+    snes->cpu->d ? 'D' : 'd', snes->cpu->i ? 'I' : 'i', cpu_getFlags(snes->cpu) & 2 ? 'Z' : 'z', snes->cpu->c ? 'C' : 'c'
   );
 }
 
@@ -116,11 +119,39 @@ void getProcessorStateSpc(Snes* snes, char* line) {
   sprintf(
     line, "SPC %04x %s A:%02x X:%02x Y:%02x SP:%02x %c%c%c%c%c%c%c%c",
     snes->apu->spc->pc, disLine, snes->apu->spc->a, snes->apu->spc->x, snes->apu->spc->y, snes->apu->spc->sp,
-    snes->apu->spc->n ? 'N' : 'n', snes->apu->spc->v ? 'V' : 'v', snes->apu->spc->p ? 'P' : 'p', snes->apu->spc->b ? 'B' : 'b',
-    snes->apu->spc->h ? 'H' : 'h', snes->apu->spc->i ? 'I' : 'i', snes->apu->spc->z ? 'Z' : 'z', snes->apu->spc->c ? 'C' : 'c'
+    spc_getFlags(snes->apu->spc) & 0x80 ? 'N' : 'n', snes->apu->spc->v ? 'V' : 'v', snes->apu->spc->p ? 'P' : 'p', snes->apu->spc->b ? 'B' : 'b',
+    snes->apu->spc->h ? 'H' : 'h', snes->apu->spc->i ? 'I' : 'i', spc_getFlags(snes->apu->spc) & 2 ? 'Z' : 'z', snes->apu->spc->c ? 'C' : 'c'
   );
 }
 
+void getTraceRecordLine(const TraceRecord* record, char* line) {
+  // same format as getProcessorStateCpu/Spc, from the trace record, with the cycle added
+  // line needs room for 100 characters
+  char flags[9] = "nvmxdizc";
+  for(int i = 0; i < 8; i++) {
+    if(record->flags & (0x80 >> i)) flags[i] -= 'a' - 'A';
+  }
+  if(record->processor == traceCpu) {
+    char disLine[14] = "             ";
+    disassembleCpu(record->bytes, record->pc, record->flags & 0x20, record->flags & 0x10, disLine);
+    sprintf(
+      line, "CPU %02x:%04x %s A:%04x X:%04x Y:%04x SP:%04x DP:%04x DB:%02x %c %s C:%llu",
+      record->bank, record->pc, disLine, record->a, record->x, record->y, record->sp, record->dp, record->db,
+      record->e ? 'E' : 'e', flags, (unsigned long long) record->cycle
+    );
+  } else {
+    flags[2] = record->flags & 0x20 ? 'P' : 'p';
+    flags[3] = record->flags & 0x10 ? 'B' : 'b';
+    flags[4] = record->flags & 0x08 ? 'H' : 'h';
+    char disLine[18] = "                 ";
+    disassembleSpc(record->bytes, record->pc, disLine);
+    sprintf(
+      line, "SPC %04x %s A:%02x X:%02x Y:%02x SP:%02x %s C:%llu",
+      record->pc, disLine, record->a, record->x, record->y, record->sp, flags, (unsigned long long) record->cycle
+    );
+  }
+}
+
 static void getDisassemblyCpu(Snes* snes, char* line) {
   uint32_t adr = snes->cpu->pc | (snes->cpu->k << 16);
   if(snes->cpu->stopped) {
@@ -137,13 +168,33 @@ static void getDisassemblyCpu(Snes* snes, char* line) {
   }
   // read 4 bytes
   // TODO: this can have side effects, implement and use peaking
-  uint8_t opcode = snes_read(snes, adr);
-  uint8_t byte = snes_read(snes, (adr + 1) & 0xffffff);
-  uint8_t byte2 = snes_read(snes, (adr + 2) & 0xffffff);
+  uint8_t bytes[4];
+  for(int i = 0; i < 4; i++) bytes[i] = snes_read(snes, (adr + i) & 0xffffff);
+  disassembleCpu(bytes, snes->cpu->pc, snes->cpu->mf, snes->cpu->xf, line);
+}
+
+void getDisassemblySpc(Snes* snes, char* line) {
+  uint16_t adr = snes->apu->spc->pc;
+  if(snes->apu->spc->stopped) {
+    sprintf(line, "%s", "<stopped>        ");
+    return;
+  }
+  // read 3 bytes
+  // TODO: this can have side effects, implement and use peaking
+  uint8_t bytes[3];
+  for(int i = 0; i < 3; i++) bytes[i] = apu_read(snes->apu, (adr + i) & 0xffff);
+  disassembleSpc(bytes, adr, line);
+}
+
+static void disassembleCpu(const uint8_t* bytes, uint16_t pc, bool mf, bool xf, char* line) {
+  // bytes holds the opcode and 3 bytes after it
+  uint8_t opcode = bytes[0];
+  uint8_t byte = bytes[1];
+  uint8_t byte2 = bytes[2];
   uint16_t word = (byte2 << 8) | byte;
-  uint32_t longv = (snes_read(snes, (adr + 3) & 0xffffff) << 16) | word;
-  uint16_t rel = snes->cpu->pc + 2 + (int8_t) byte;
-  uint16_t rell = snes->cpu->pc + 3 + (int16_t) word;
+  uint32_t longv = (bytes[3] << 16) | word;
+  uint16_t rel = pc + 2 + (int8_t) byte;
+  uint16_t rell = pc + 3 + (int16_t) word;
   // switch on type
   switch(opcodeType[opcode]) {
     case 0: sprintf(line, "%s", opcodeNames[opcode]); break;
@@ -152,7 +203,7 @@ static void getDisassemblyCpu(Snes* snes, char* line) {
     case 3: sprintf(line, opcodeNames[opcode], longv); break;
     case 4: {
       char num[5] = "    ";
-      if(snes->cpu->mf) {
+      if(mf) {
         sprintf(num, "%02x  ", byte);
       } else {
         sprintf(num, "%04x", word);
@@ -162,7 +213,7 @@ static void getDisassemblyCpu(Snes* snes, char* line) {
     }
     case 5: {
       char num[5] = "    ";
-      if(snes->cpu->xf) {
+      if(xf) {
         sprintf(num, "%02x  ", byte);
       } else {
         sprintf(num, "%04x", word);
@@ -176,20 +227,14 @@ static void getDisassemblyCpu(Snes* snes, char* line) {
   }
 }
 
-void getDisassemblySpc(Snes* snes, char* line) {
-  uint16_t adr = snes->apu->spc->pc;
-  if(snes->apu->spc->stopped) {
-    sprintf(line, "%s", "<stopped>        ");
-    return;
-  }
-  // read 3 bytes
-  // TODO: this can have side effects, implement and use peaking
-  uint8_t opcode = apu_read(snes->apu, adr);
-  uint8_t byte = apu_read(snes->apu, (adr + 1) & 0xffff);
-  uint8_t byte2 = apu_read(snes->apu, (adr + 2) & 0xffff);
+static void disassembleSpc(const uint8_t* bytes, uint16_t pc, char* line) {
+  // bytes holds the opcode and 2 bytes after it
+  uint8_t opcode = bytes[0];
+  uint8_t byte = bytes[1];
+  uint8_t byte2 = bytes[2];
   uint16_t word = (byte2 << 8) | byte;
-  uint16_t rel = snes->apu->spc->pc + 2 + (int8_t) byte;
-  uint16_t rel2 = snes->apu->spc->pc + 2 + (int8_t) byte2;
+  uint16_t rel = pc + 2 + (int8_t) byte;
+  uint16_t rel2 = pc + 2 + (int8_t) byte2;
   uint16_t wordb = word & 0x1fff;
   uint8_t bit = word >> 13;
   // switch on type
@@ -6,8 +6,10 @@
 #include <stdbool.h>
 
 #include "snes.h"
+#include "trace.h"
 
 void getProcessorStateCpu(Snes* snes, char* line);
 void getProcessorStateSpc(Snes* snes, char* line);
+void getTraceRecordLine(const TraceRecord* record, char* line);
 
 #endif